@@ -2,6 +2,7 @@
 #define bit_stream_h
 
 #include <stdint.h>
+#include <string.h>
 
 class bit_stream
 {
@@ -65,7 +66,7 @@ public:
 		memcpy(&value_at_seek, _seek, sizeof(int32_t));
 
 		int32_t value_to_write = value_at_seek | ((value & (0xFFFFFFFF >> (32 - bit_length))) << _bit_offset);
-		memcpy(_seek, value_to_write, sizeof(int32_t));
+		memcpy(_seek, &value_to_write, sizeof(int32_t));
 
 		_bit_offset += bit_length;
 		_seek += _bit_offset / 8;
@@ -115,7 +116,7 @@ public:
 		_seek += _bit_offset / 8;
 		_bit_offset = _bit_offset % 8;
 			
-		return value;
+		return value_at_seek;
 	}		
 	template<uint8_t bit_length>
 	uint32_t read_uint()
@@ -0,0 +1,163 @@
+#ifndef onyx_buffer_pool_h
+#define onyx_buffer_pool_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+/*
+ * fixed size blocks of memory shared by reference count
+ *
+ * blocks are carved out of chunks that are never moved or freed until the pool is destroyed. the first
+ * chunk holds blocks_per_chunk blocks and every chunk added when the pool runs dry doubles the blocks,
+ * so there are only ever a handful of chunks, kept sorted by address to find the one a block is in.
+ * acquire hands out a block holding a single reference, the block goes back to the pool once the last
+ * reference to it is released. retain and release take a pointer to anywhere inside a block.
+ */
+class buffer_pool
+{
+public:
+	buffer_pool() : _block_size(0), _blocks_per_chunk(0), _blocks(0) { }
+	~buffer_pool()
+	{
+		destroy();
+	}
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+
+	void create(size_t block_size, size_t blocks_per_chunk)
+	{
+		destroy();
+
+		_block_size = block_size;
+		_blocks_per_chunk = blocks_per_chunk;
+	}
+	void destroy()
+	{
+		for (size_t i = 0; i < _chunks.size(); ++i)
+		{
+			delete[] _chunks[i].begin;
+			delete[] _chunks[i].references;
+		}
+
+		_chunks.clear();
+		_free.clear();
+
+		_block_size = 0;
+		_blocks_per_chunk = 0;
+		_blocks = 0;
+	}
+
+	size_t block_size() const { return _block_size; }
+
+	char* acquire()
+	{
+		if (_free.empty())
+		{
+			grow();
+		}
+
+		char* block = _free.back();
+		_free.pop_back();
+
+		*find_references(block) = 1;
+		return block;
+	}
+	void retain(const char* ptr)
+	{
+		++*find_references(ptr);
+	}
+	void release(const char* ptr)
+	{
+		const chunk& c = _chunks[owning_chunk(ptr)];
+		size_t block = (ptr - c.begin) / _block_size;
+
+		if (--c.references[block] == 0)
+		{
+			_free.push_back(c.begin + block * _block_size);
+		}
+	}
+
+	bool owns(const char* ptr) const
+	{
+		return find_chunk(ptr) < _chunks.size();
+	}
+
+private:
+	struct chunk
+	{
+		char*		begin;
+		char*		end;
+		uint32_t*	references;
+	};
+
+	void grow()
+	{
+		size_t blocks = _blocks == 0 ? _blocks_per_chunk : _blocks;
+
+		chunk c;
+		c.begin = new char[_block_size * blocks];
+		c.end = c.begin + _block_size * blocks;
+		c.references = new uint32_t[blocks]();
+
+		_chunks.insert(std::upper_bound(_chunks.begin(), _chunks.end(), c, chunk_before), c);
+		_blocks += blocks;
+
+		// hand the blocks out front to back
+
+		for (size_t i = blocks; i > 0; --i)
+		{
+			_free.push_back(c.begin + (i - 1) * _block_size);
+		}
+	}
+
+	static bool chunk_before(const chunk& lhs, const chunk& rhs) { return lhs.begin < rhs.begin; }
+
+	// the last chunk starting at or before ptr, or _chunks.size() if ptr isn't in any of them
+	size_t find_chunk(const char* ptr) const
+	{
+		size_t low = 0;
+		size_t high = _chunks.size();
+
+		while (low < high)
+		{
+			size_t middle = (low + high) / 2;
+
+			if (_chunks[middle].begin <= ptr)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if (low == 0 || ptr >= _chunks[low - 1].end)
+		{
+			return _chunks.size();
+		}
+
+		return low - 1;
+	}
+	size_t owning_chunk(const char* ptr) const
+	{
+		size_t i = find_chunk(ptr);
+		assert(i < _chunks.size() && "the pointer isn't in a block of this pool");
+
+		return i;
+	}
+	uint32_t* find_references(const char* ptr)
+	{
+		const chunk& c = _chunks[owning_chunk(ptr)];
+		return &c.references[(ptr - c.begin) / _block_size];
+	}
+
+	size_t				_block_size;
+	size_t				_blocks_per_chunk;
+	size_t				_blocks;
+
+	std::vector<chunk>	_chunks;
+	std::vector<char*>	_free;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#ifndef onyx_congestion_controller_h
+#define onyx_congestion_controller_h
+
+#include <stdint.h>
+
+// what a connection reports to its congestion controller whenever an ack acknowledges new packets
+
+struct congestion_ack
+{
+	// packets newly acknowledged by this ack
+	uint32_t	acknowledged;
+
+	// packets that were in flight on the connection before this ack
+	uint32_t	in_flight;
+
+	// when the most recently sent of the acknowledged packets was first sent
+	uint64_t	newest_send_time;
+
+	// the round trip measured by this ack, 0 if it could not be measured
+	uint64_t	rtt_sample;
+	uint64_t	smoothed_rtt;
+};
+
+/*
+ * decides how many packets a connection may have in flight across its messengers
+ *
+ * loss based algorithms react to on_loss and on_timeout, delay based ones can use the rtt samples
+ * carried by on_ack. a connection owns one controller, created through the factory in
+ * network_session_config, and deletes it when the connection is destroyed.
+ */
+class congestion_controller
+{
+public:
+	virtual ~congestion_controller() { }
+
+	virtual void reset(uint64_t current_time) = 0;
+
+	virtual void on_ack(const congestion_ack& ack, uint64_t current_time) = 0;
+
+	// a packet first sent at lost_send_time was reported missing by the remote
+	virtual void on_loss(uint64_t lost_send_time, uint64_t current_time) = 0;
+
+	// a resend timer fired, the oldest unacknowledged packet was first sent at lost_send_time
+	virtual void on_timeout(uint64_t lost_send_time, uint64_t current_time) = 0;
+
+	// in packets
+	virtual uint32_t congestion_window() const = 0;
+
+	// microseconds between paced packets, by default the window is spread over 4/5ths of a round trip
+	virtual uint64_t pacing_interval(uint64_t smoothed_rtt) const
+	{
+		return smoothed_rtt * 4 / (5 * (uint64_t)congestion_window());
+	}
+};
+
+typedef congestion_controller* (*congestion_controller_factory)();
+
+// slow start, congestion avoidance and multiplicative decrease as in rfc 5681 and rfc 6582,
+// counted in packets instead of bytes
+
+class newreno_controller : public congestion_controller
+{
+public:
+	static const uint32_t initial_window = 10;
+	static const uint32_t minimum_window = 2;
+
+	static congestion_controller* create() { return new newreno_controller(); }
+
+	newreno_controller() { reset(0); }
+
+	void reset(uint64_t current_time) override
+	{
+		_window = initial_window;
+		_slow_start_threshold = ~((uint32_t)0);
+		_acknowledged_in_window = 0;
+		_recovery_start_time = current_time;
+	}
+
+	void on_ack(const congestion_ack& ack, uint64_t) override
+	{
+		// acks for packets sent before the last reduction belong to the loss being recovered from
+
+		if (ack.newest_send_time <= _recovery_start_time)
+		{
+			return;
+		}
+
+		// only grow while the window is actually being used, an idle sender learns nothing about the path
+
+		if (ack.in_flight * 2 < _window)
+		{
+			return;
+		}
+
+		if (_window < _slow_start_threshold)
+		{
+			_window += ack.acknowledged;
+			return;
+		}
+
+		_acknowledged_in_window += ack.acknowledged;
+
+		while (_acknowledged_in_window >= _window)
+		{
+			_acknowledged_in_window -= _window;
+			++_window;
+		}
+	}
+
+	void on_loss(uint64_t lost_send_time, uint64_t current_time) override
+	{
+		// one reduction per window of data, further losses from the same window are part of it
+
+		if (lost_send_time <= _recovery_start_time)
+		{
+			return;
+		}
+
+		_recovery_start_time = current_time;
+
+		_slow_start_threshold = reduced_window();
+		_window = _slow_start_threshold;
+		_acknowledged_in_window = 0;
+	}
+
+	void on_timeout(uint64_t lost_send_time, uint64_t current_time) override
+	{
+		if (lost_send_time > _recovery_start_time)
+		{
+			_slow_start_threshold = reduced_window();
+		}
+
+		_recovery_start_time = current_time;
+
+		_window = 1;
+		_acknowledged_in_window = 0;
+	}
+
+	uint32_t congestion_window() const override { return _window; }
+
+	// slow start doubles the window every round trip, so it is paced twice as fast to keep up
+	uint64_t pacing_interval(uint64_t smoothed_rtt) const override
+	{
+		if (_window < _slow_start_threshold)
+		{
+			return smoothed_rtt / (2 * (uint64_t)_window);
+		}
+
+		return congestion_controller::pacing_interval(smoothed_rtt);
+	}
+
+private:
+	uint32_t reduced_window() const { return _window / 2 > minimum_window ? _window / 2 : minimum_window; }
+
+	uint32_t	_window;
+	uint32_t	_slow_start_threshold;
+	uint32_t	_acknowledged_in_window;
+
+	uint64_t	_recovery_start_time;
+};
+
+/*
+ * spreads the packets of a connection over its round trip instead of sending them back to back
+ *
+ * a token bucket kept as the time the next packet may leave, every packet sent pushes it back by
+ * one interval. unused time accumulates for at most burst_size packets, so a connection that was
+ * idle can send a short burst but never a whole window at once.
+ */
+class send_pacer
+{
+public:
+	static const uint32_t burst_size = 2;
+
+	send_pacer() : _next_send_time(0) { }
+
+	void reset() { _next_send_time = 0; }
+
+	bool can_send(uint64_t current_time) const { return current_time >= _next_send_time; }
+	uint64_t next_send_time() const { return _next_send_time; }
+
+	// an interval of 0 leaves the packet unpaced
+	void on_packet_sent(uint64_t current_time, uint64_t interval)
+	{
+		uint64_t credit = (burst_size - 1) * interval;
+		uint64_t earliest = current_time > credit ? current_time - credit : 0;
+
+		_next_send_time = (_next_send_time > earliest ? _next_send_time : earliest) + interval;
+	}
+
+private:
+	uint64_t	_next_send_time;
+};
+
+#endif
\ No newline at end of file
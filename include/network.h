@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+
+#if defined(_WIN32)
 
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
@@ -11,10 +16,37 @@
 #include <Ws2tcpip.h>
 #pragma comment(lib, "Ws2_32.lib")
 
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+typedef int SOCKET;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+static int closesocket(SOCKET sock)
+{
+	return close(sock);
+}
+
+#endif
+
 #if !defined(NETWORK_USE_IPV6)
 #define NETWORK_USE_IPV4
 #endif
 
+#if defined(_WIN32)
+
 class network_timer
 {
 public:
@@ -58,14 +90,63 @@ private:
 	LARGE_INTEGER _frequency;
 };
 
+#else
+
+class network_timer
+{
+public:
+	uint64_t get_milliseconds()
+	{
+		return get_nanoseconds() / 1000000;
+	}
+	uint64_t get_microseconds()
+	{
+		return get_nanoseconds() / 1000;
+	}
+	uint64_t get_nanoseconds()
+	{
+		struct timespec current_time;
+		clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+		return (uint64_t)current_time.tv_sec * 1000000000 + (uint64_t)current_time.tv_nsec;
+	}
+};
+
+#endif
+
+inline bool network_startup()
+{
+#if defined(_WIN32)
+	WSAData wsa_data;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	{
+		printf("error initializing WSA\n");
+		return false;
+	}
+#endif
+
+	return true;
+}
+inline void network_shutdown()
+{
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
+
 static void print_wsa_error()
 {
+#if defined(_WIN32)
 	auto last_error = WSAGetLastError();
 
 	if (last_error == 10047)
 	{
 		__debugbreak();
 	}
+#else
+	auto last_error = errno;
+#endif
 
 	printf("last error: %d\n", last_error);
 }
@@ -77,7 +158,7 @@ public:
 	{
 		struct addrinfo* host_addr = nullptr;
 		struct addrinfo hints;
-		ZeroMemory(&hints, sizeof(hints));
+		memset(&hints, 0, sizeof(hints));
 
 #if defined(NETWORK_USE_IPV6)
 		hints.ai_family = AF_INET6;
@@ -92,7 +173,7 @@ public:
 
 		if (addr_result != 0)
 		{
-			printf("error resolving the host service ip_address: %s.\n", gai_strerrorA(addr_result));
+			printf("error resolving the host service ip_address: %s.\n", gai_strerror(addr_result));
 			return false;
 		}
 
@@ -118,18 +199,11 @@ static bool operator==(const ip_address& a, const ip_address& b)
 {
 #if defined(NETWORK_USE_IPV6)
 	return a.wsa_ip_address.sin6_family == b.wsa_ip_address.sin6_family && a.wsa_ip_address.sin6_port == b.wsa_ip_address.sin6_port &&
-		a.wsa_ip_address.sin6_addr.u.Word[0] == b.wsa_ip_address.sin6_addr.u.Word[0] &&
-		a.wsa_ip_address.sin6_addr.u.Word[1] == b.wsa_ip_address.sin6_addr.u.Word[1] &&
-		a.wsa_ip_address.sin6_addr.u.Word[2] == b.wsa_ip_address.sin6_addr.u.Word[2] &&
-		a.wsa_ip_address.sin6_addr.u.Word[3] == b.wsa_ip_address.sin6_addr.u.Word[3] &&
-		a.wsa_ip_address.sin6_addr.u.Word[4] == b.wsa_ip_address.sin6_addr.u.Word[4] &&
-		a.wsa_ip_address.sin6_addr.u.Word[5] == b.wsa_ip_address.sin6_addr.u.Word[5] &&
-		a.wsa_ip_address.sin6_addr.u.Word[6] == b.wsa_ip_address.sin6_addr.u.Word[6] &&
-		a.wsa_ip_address.sin6_addr.u.Word[7] == b.wsa_ip_address.sin6_addr.u.Word[7];
+		memcmp(&a.wsa_ip_address.sin6_addr, &b.wsa_ip_address.sin6_addr, sizeof(a.wsa_ip_address.sin6_addr)) == 0;
 #else
 	return a.wsa_ip_address.sin_family == b.wsa_ip_address.sin_family &&
 		a.wsa_ip_address.sin_port == b.wsa_ip_address.sin_port &&
-		a.wsa_ip_address.sin_addr.S_un.S_addr == b.wsa_ip_address.sin_addr.S_un.S_addr;
+		a.wsa_ip_address.sin_addr.s_addr == b.wsa_ip_address.sin_addr.s_addr;
 #endif
 }
 static bool operator!=(const ip_address& a, const ip_address& b)
@@ -137,20 +211,61 @@ static bool operator!=(const ip_address& a, const ip_address& b)
 	return !(a == b);
 }
 
+namespace std
+{
+	template<>
+	struct hash<ip_address>
+	{
+		size_t operator()(const ip_address& addr) const
+		{
+			// fnv-1a over the address and port, the same fields operator== compares
+
+#if defined(NETWORK_USE_IPV6)
+			const uint8_t* bytes = (const uint8_t*)&addr.wsa_ip_address.sin6_addr;
+			size_t length = sizeof(addr.wsa_ip_address.sin6_addr);
+			uint16_t port = addr.wsa_ip_address.sin6_port;
+#else
+			const uint8_t* bytes = (const uint8_t*)&addr.wsa_ip_address.sin_addr;
+			size_t length = sizeof(addr.wsa_ip_address.sin_addr);
+			uint16_t port = addr.wsa_ip_address.sin_port;
+#endif
+
+			uint64_t result = 0xCBF29CE484222325ull;
+
+			for (size_t i = 0; i < length; ++i)
+			{
+				result = (result ^ bytes[i]) * 0x100000001B3ull;
+			}
+
+			result = (result ^ (port & 0xFF)) * 0x100000001B3ull;
+			result = (result ^ (port >> 8)) * 0x100000001B3ull;
+
+			return (size_t)result;
+		}
+	};
+}
+
 class udp_socket
 {
 public:
-	udp_socket() : wsa_socket(INVALID_SOCKET) { }
+	udp_socket() : drop_packets(false), wsa_socket(INVALID_SOCKET), _send_buffer(nullptr), _send_capacity(0), _send_count(0) { }
 	~udp_socket()
 	{
 		destroy();
 	}
 
+	udp_socket(const udp_socket&) = delete;
+	udp_socket& operator=(const udp_socket&) = delete;
+
 	static const int recv_buf_size = 1024 * 256;
 	static const int send_buf_size = 1024 * 16;
 	static const int drop_rate = 4;
 
-	bool create(const char* port_number, bool should_drop_packets = false)
+	// the maximum amount of datagrams moved by a single call to try_receive_batch or flush
+
+	static const uint32_t batch_size = 64;
+
+	bool create(const char* port_number, bool should_drop_packets = false, size_t max_datagram_size = 1500)
 	{
 		destroy();
 
@@ -158,7 +273,7 @@ public:
 
 		struct addrinfo* host_addr = nullptr;
 		struct addrinfo hints;
-		ZeroMemory(&hints, sizeof(hints));
+		memset(&hints, 0, sizeof(hints));
 
 #if defined(NETWORK_USE_IPV6)
 		hints.ai_family = AF_INET6;
@@ -208,29 +323,65 @@ public:
 
 		int sock_opt = udp_socket::recv_buf_size;
 		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)& sock_opt, sizeof(sock_opt));
+#if defined(_WIN32)
 		sock_opt = 0;
 		setsockopt(sock, SOL_SOCKET, SO_LINGER, (char *)& sock_opt, sizeof(sock_opt));
+#endif
 		sock_opt = udp_socket::send_buf_size;
 		setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)& sock_opt, sizeof(sock_opt));
 
-#ifdef _WIN32
+		// never let ip fragment a datagram, one too large for the path is dropped instead so the
+		// path mtu can be probed for
+#if defined(_WIN32)
+		sock_opt = 1;
+#if defined(NETWORK_USE_IPV6)
+		setsockopt(sock, IPPROTO_IPV6, IPV6_DONTFRAG, (char *)& sock_opt, sizeof(sock_opt));
+#else
+		setsockopt(sock, IPPROTO_IP, IP_DONTFRAGMENT, (char *)& sock_opt, sizeof(sock_opt));
+#endif
+#elif defined(NETWORK_USE_IPV6) && defined(IPV6_MTU_DISCOVER)
+		sock_opt = IPV6_PMTUDISC_PROBE;
+		setsockopt(sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (char *)& sock_opt, sizeof(sock_opt));
+#elif !defined(NETWORK_USE_IPV6) && defined(IP_MTU_DISCOVER)
+		sock_opt = IP_PMTUDISC_PROBE;
+		setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, (char *)& sock_opt, sizeof(sock_opt));
+#endif
+
+#if defined(_WIN32)
 		unsigned long non_blocking = 1;
 		ioctlsocket(sock, FIONBIO, &non_blocking);
 #else
-		fcntl(rns2Socket, F_SETFL, O_NONBLOCK);
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
 #endif
 
 		wsa_socket = sock;
 
+		_send_capacity = max_datagram_size;
+		_send_buffer = new char[_send_capacity * udp_socket::batch_size];
+		_send_count = 0;
+
 		return true;
 	}
+	SOCKET native_handle() const { return wsa_socket; }
+
 	void destroy()
 	{
 		if (wsa_socket != INVALID_SOCKET)
 		{
+			flush();
+
 			closesocket(wsa_socket);
 			wsa_socket = INVALID_SOCKET;
 		}
+
+		if (_send_buffer != nullptr)
+		{
+			delete[] _send_buffer;
+			_send_buffer = nullptr;
+		}
+
+		_send_capacity = 0;
+		_send_count = 0;
 	}
 
 	bool send(const char* buffer, uint32_t length, ip_address to)
@@ -255,9 +406,119 @@ public:
 
 		return true;
 	}
+
+	// copies the datagram into the pending batch, it is not sent until flush is called or the batch fills up
+	// returns whether this datagram was taken, a full batch that fails to flush turns it down
+
+	bool queue_send(const char* buffer, uint32_t length, const ip_address& to)
+	{
+		if (length > _send_capacity)
+		{
+			return send(buffer, length, to);
+		}
+
+		if (drop_packets && (rand() % drop_rate) == 0)
+		{
+			return true;
+		}
+
+		if (_send_count == udp_socket::batch_size && !flush())
+		{
+			return false;
+		}
+
+		memcpy(_send_buffer + _send_count * _send_capacity, buffer, length);
+		_send_lengths[_send_count] = length;
+		_send_addresses[_send_count] = to;
+		++_send_count;
+
+		return true;
+	}
+	bool flush()
+	{
+		bool result = true;
+
+#if defined(_WIN32)
+		for (uint32_t i = 0; i < _send_count; ++i)
+		{
+			if (sendto(
+				wsa_socket,
+				_send_buffer + i * _send_capacity,
+				_send_lengths[i],
+				0,
+				(sockaddr*)&_send_addresses[i].wsa_ip_address,
+				sizeof(_send_addresses[i].wsa_ip_address)
+				) != _send_lengths[i])
+			{
+				result = false;
+			}
+		}
+#else
+		for (uint32_t i = 0; i < _send_count; ++i)
+		{
+			_send_iovecs[i].iov_base = _send_buffer + i * _send_capacity;
+			_send_iovecs[i].iov_len = _send_lengths[i];
+
+			memset(&_send_headers[i], 0, sizeof(_send_headers[i]));
+			_send_headers[i].msg_hdr.msg_name = &_send_addresses[i].wsa_ip_address;
+			_send_headers[i].msg_hdr.msg_namelen = sizeof(_send_addresses[i].wsa_ip_address);
+			_send_headers[i].msg_hdr.msg_iov = &_send_iovecs[i];
+			_send_headers[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		uint32_t sent = 0;
+		while (sent < _send_count)
+		{
+			int batch_result = sendmmsg(wsa_socket, _send_headers + sent, _send_count - sent, 0);
+
+			if (batch_result < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				// a datagram larger than the path allows is dropped on its own, it is usually an mtu probe
+
+				if (errno == EMSGSIZE)
+				{
+					++sent;
+					continue;
+				}
+
+				// the socket buffer is full or the send failed, the rest of the batch is lost
+				// just like it would have been on the wire
+
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					print_wsa_error();
+				}
+
+				result = false;
+				break;
+			}
+
+			sent += batch_result;
+		}
+#endif
+
+		if (!result)
+		{
+			printf("an error occured in sending a udp_packet.\n");
+		}
+
+		_send_count = 0;
+
+		return result;
+	}
+
 	bool try_receive(char* buffer, size_t buffer_capacity, size_t* amount_written, ip_address* from)
 	{
+#if defined(_WIN32)
 		int from_len = sizeof(from->wsa_ip_address);
+#else
+		socklen_t from_len = sizeof(from->wsa_ip_address);
+#endif
 
 		int result =
 			recvfrom(
@@ -280,9 +541,222 @@ public:
 		}
 	}
 
+	// receives up to count datagrams, datagram i is written to buffers[i] which holds buffer_capacity bytes
+	// returns the amount of datagrams received, truncated datagrams are reported with a length of zero
+
+	uint32_t try_receive_batch(char* const* buffers, size_t buffer_capacity, size_t* amounts_written, ip_address* from, uint32_t count)
+	{
+		if (count > udp_socket::batch_size)
+		{
+			count = udp_socket::batch_size;
+		}
+
+#if defined(_WIN32)
+		uint32_t received = 0;
+
+		while (received < count && try_receive(buffers[received], buffer_capacity, &amounts_written[received], &from[received]))
+		{
+			++received;
+		}
+
+		return received;
+#else
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			_receive_iovecs[i].iov_base = buffers[i];
+			_receive_iovecs[i].iov_len = buffer_capacity;
+
+			memset(&_receive_headers[i], 0, sizeof(_receive_headers[i]));
+			_receive_headers[i].msg_hdr.msg_name = &from[i].wsa_ip_address;
+			_receive_headers[i].msg_hdr.msg_namelen = sizeof(from[i].wsa_ip_address);
+			_receive_headers[i].msg_hdr.msg_iov = &_receive_iovecs[i];
+			_receive_headers[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int result = recvmmsg(wsa_socket, _receive_headers, count, MSG_DONTWAIT, nullptr);
+
+		if (result <= 0)
+		{
+			return 0;
+		}
+
+		for (int i = 0; i < result; ++i)
+		{
+			amounts_written[i] = (_receive_headers[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : _receive_headers[i].msg_len;
+		}
+
+		return (uint32_t)result;
+#endif
+	}
+
 private:
 	bool drop_packets;
 	SOCKET wsa_socket;
+
+	char*		_send_buffer;
+	size_t		_send_capacity;
+	uint32_t	_send_count;
+	uint32_t	_send_lengths[batch_size];
+	ip_address	_send_addresses[batch_size];
+
+#if !defined(_WIN32)
+	mmsghdr		_send_headers[batch_size];
+	iovec		_send_iovecs[batch_size];
+
+	mmsghdr		_receive_headers[batch_size];
+	iovec		_receive_iovecs[batch_size];
+#endif
+};
+
+// blocks until a udp_socket has datagrams to read or an absolute deadline on the network_timer clock passes
+// on linux this is an epoll set holding the socket and a timerfd armed with the deadline
+
+class network_waiter
+{
+public:
+	static const uint64_t no_deadline = ~((uint64_t)0);
+
+#if defined(_WIN32)
+	network_waiter() : _socket(INVALID_SOCKET) { }
+#else
+	network_waiter() : _epoll(-1), _timer(-1) { }
+#endif
+	~network_waiter()
+	{
+		destroy();
+	}
+
+	network_waiter(const network_waiter&) = delete;
+	network_waiter& operator=(const network_waiter&) = delete;
+
+	bool create(const udp_socket& socket)
+	{
+		destroy();
+
+#if defined(_WIN32)
+		_socket = socket.native_handle();
+#else
+		_epoll = epoll_create1(0);
+		_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+		if (_epoll < 0 || _timer < 0)
+		{
+			printf("error creating the network waiter.\n");
+			print_wsa_error();
+			destroy();
+			return false;
+		}
+
+		epoll_event socket_event;
+		memset(&socket_event, 0, sizeof(socket_event));
+		socket_event.events = EPOLLIN;
+		socket_event.data.fd = socket.native_handle();
+
+		epoll_event timer_event;
+		memset(&timer_event, 0, sizeof(timer_event));
+		timer_event.events = EPOLLIN;
+		timer_event.data.fd = _timer;
+
+		if (epoll_ctl(_epoll, EPOLL_CTL_ADD, socket.native_handle(), &socket_event) != 0 ||
+			epoll_ctl(_epoll, EPOLL_CTL_ADD, _timer, &timer_event) != 0)
+		{
+			printf("error registering the socket with the network waiter.\n");
+			print_wsa_error();
+			destroy();
+			return false;
+		}
+#endif
+
+		return true;
+	}
+	void destroy()
+	{
+#if defined(_WIN32)
+		_socket = INVALID_SOCKET;
+#else
+		if (_timer >= 0)
+		{
+			close(_timer);
+			_timer = -1;
+		}
+		if (_epoll >= 0)
+		{
+			close(_epoll);
+			_epoll = -1;
+		}
+#endif
+	}
+
+	// returns true if the socket became readable, false if the deadline passed first
+
+	bool wait(uint64_t deadline, uint64_t current_time)
+	{
+		if (deadline <= current_time)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(_socket, &read_set);
+
+		timeval* timeout_ptr = nullptr;
+		timeval timeout;
+
+		if (deadline != network_waiter::no_deadline)
+		{
+			uint64_t wait_time = deadline - current_time;
+			timeout.tv_sec = (long)(wait_time / 1000000);
+			timeout.tv_usec = (long)(wait_time % 1000000);
+			timeout_ptr = &timeout;
+		}
+
+		return select(0, &read_set, nullptr, nullptr, timeout_ptr) > 0;
+#else
+		itimerspec timer_value;
+		memset(&timer_value, 0, sizeof(timer_value));
+
+		if (deadline != network_waiter::no_deadline)
+		{
+			timer_value.it_value.tv_sec = deadline / 1000000;
+			timer_value.it_value.tv_nsec = (deadline % 1000000) * 1000;
+		}
+
+		// a zeroed timer value disarms the timer and we wait on the socket alone
+
+		timerfd_settime(_timer, TFD_TIMER_ABSTIME, &timer_value, nullptr);
+
+		bool readable = false;
+		epoll_event events[2];
+
+		int result = epoll_wait(_epoll, events, 2, -1);
+
+		for (int i = 0; i < result; ++i)
+		{
+			if (events[i].data.fd == _timer)
+			{
+				uint64_t expirations;
+				ssize_t read_result = read(_timer, &expirations, sizeof(expirations));
+				(void)read_result;
+			}
+			else
+			{
+				readable = true;
+			}
+		}
+
+		return readable;
+#endif
+	}
+
+private:
+#if defined(_WIN32)
+	SOCKET	_socket;
+#else
+	int		_epoll;
+	int		_timer;
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -8,12 +8,16 @@
 #include <algorithm>
 #include <stdint.h>
 #include <list>
+#include <unordered_map>
 #include <random>
 
 #include "uuid.h"
 #include "bit_stream.h"
 #include "network.h"
-#include "circular_allocator.h"
+#include "segmented_allocator.h"
+#include "congestion_controller.h"
+#include "slot_map.h"
+#include "ring_queue.h"
 
 enum connection_result : uint32_t
 {
@@ -21,8 +25,35 @@ enum connection_result : uint32_t
 	connection_result_invalid_protocol = 1,
 	connection_result_invalid_password = 2,
 	connection_result_server_full = 2,
+	connection_result_invalid_configuration = 4,
 };
 
+// what became of a message handed to one of the send functions
+enum send_result : uint32_t
+{
+	send_result_accepted = 0,
+	send_result_would_block = 1,
+	send_result_not_connected = 2,
+	send_result_invalid = 3,
+};
+
+// queued reliable and stream messages of a higher priority are sent before any of a lower priority
+enum message_priority : uint32_t
+{
+	message_priority_low = 0,
+	message_priority_normal = 1,
+	message_priority_high = 2,
+};
+
+// [s] fields are sequence numbers, 2 or 4 bytes wide depending on the sequence_bits negotiated for the connection
+//
+// an [ack] block acknowledges messages on the reliable and stream channels:
+//  [s] next_desired_message
+//  [1] range_count
+//  range_count times:
+//   [2] range_offset, from next_desired_message to the first message of the range
+//   [2] range_length, the amount of consecutive messages received
+
 class message_type
 {
 public:
@@ -32,11 +63,17 @@ public:
 	 * [4] protocol_version
 	 * [4] password
 	 * [16] guid
+	 * [1] sequence_bits
+	 * [2] window_size
+	 * [1] stream_channels
 	 */
 	static const uint8_t connection_request = 1;
 	/*
 	 * [1] header
 	 * [16] guid
+	 * [1] sequence_bits
+	 * [2] window_size
+	 * [1] stream_channels
 	 */
 	static const uint8_t connection_accepted = 2;
 	/*
@@ -63,13 +100,21 @@ public:
 
 	/*
 	 * [1] header
-	 * [1] stream_next_desired_message
-	 * [1] reliable_next_desired_message
-	 * [2] reliable_message_status
+	 * [8] ping_time
+	 * [ack] stream_status, one for each stream channel
+	 * [ack] reliable_status
+	 * a ping probing the path mtu goes on with:
+	 * [2] probe_size, the size of the whole datagram
+	 * [x] padding
 	 */
 	static const uint8_t ping = 7;
 	/*
 	 * [1] header
+	 * [8] ping_time, echoed from the ping
+	 * [ack] stream_status, one for each stream channel
+	 * [ack] reliable_status
+	 * if the ping was a probe that arrived whole:
+	 * [2] probe_size, echoed from the ping
 	 */
 	static const uint8_t ping_response = 8;
 
@@ -81,55 +126,587 @@ public:
 
 	/*
 	 * [1] header
-	 * [1] message_id
-	 * [1] next_desired_message
-	 * [2] message_status_bitfield
+	 * [s] message_id
+	 * [s] next_desired_message
 	 * [x] data
 	 */
 	static const uint8_t reliable = 10;
 	/*
 	 * [1] header
-	 * [1] next_desired_message
-	 * [2] message_status_bitfield
+	 * [ack] reliable_status
 	 */
 	static const uint8_t reliable_ack = 11;
 
 	/*
 	 * [1] header
-	 * [1] message_id
-	 * [1] next_desired_message
-	 * [2] message_status_bitfield
+	 * [1] channel
+	 * [s] message_id
+	 * [s] next_desired_message
 	 * [x] data
 	 */
 	static const uint8_t stream = 12;
 	/*
 	 * [1] header
-	 * [1] next_desired_message
-	 * [2] message_status_bitfield
+	 * [1] channel
+	 * [ack] stream_status
 	 */
 	static const uint8_t stream_ack = 13;
+
+	/*
+	 * [1] header
+	 * [1] channel
+	 * [2] sequence
+	 * [x] data
+	 */
+	static const uint8_t sequenced = 14;
+
+	/*
+	 * [1] header
+	 * [1] channel
+	 * [s] first_message_id
+	 * [1] message_count
+	 * [2] length, the lengths of the protected bytes of each message xored together
+	 * [x] parity, the protected bytes of each message xored together, the shorter ones padded with zeroes
+	 * the protected bytes of a stream message are its header followed by its data, without the channel and sequence numbers
+	 */
+	static const uint8_t stream_parity = 15;
+
+	/*
+	 * a reliable or stream packet built for an mtu the path stopped carrying, sent in parts once the mtu fell back
+	 * [1] header
+	 * [2] split_id
+	 * [2] part_index
+	 * [2] part_count
+	 * [4] packet_length
+	 * [x] the part of the packet, split like the fragments of a message
+	 */
+	static const uint8_t split = 16;
+
+	// the upper bits of the header are flags, the message type is in the rest
+
+	static const uint8_t type_mask = 0x1F;
+
+	/*
+	 * set on reliable and stream messages whose data is a series of frames
+	 * frames:
+	 *  [2] length
+	 *  [x] data
+	 */
+	static const uint8_t coalesced = 0x80;
+	/*
+	 * set on reliable and stream messages carrying part of a message too large for one packet
+	 * the fragments of a message have consecutive message ids, each data starts with:
+	 *  [2] fragment_index
+	 *  [2] fragment_count
+	 *  [4] message_length
+	 */
+	static const uint8_t fragment = 0x40;
+	/*
+	 * set on reliable messages that replace the previous message sent for their key, data starts with:
+	 *  [4] key
+	 */
+	static const uint8_t latest = 0x20;
+};
+
+// settings chosen when the session is created
+// sequence_bits, window_size and stream_channels are negotiated with each peer when connecting, the wider
+// sequence space, the smaller window and the fewer stream channels of the two sides are used for the connection
+
+struct network_session_config
+{
+	static const uint32_t maximum_window_size = 32768;
+
+	// the status of every channel has to fit a ping of base_transmission_unit bytes
+	static const uint32_t maximum_stream_channels = 8;
+
+	// every connection starts out sending packets of at most base_transmission_unit bytes,
+	// maximum_datagram_size is the most a udp datagram can carry
+	static const uint32_t base_transmission_unit = 800;
+	static const uint32_t maximum_datagram_size = 65507;
+
+	// the message count of a parity packet is a single byte
+	static const uint32_t maximum_fec_group_size = 255;
+
+	network_session_config() :
+		stream_packet_queue_buffer_size(4000),
+		reliable_packet_queue_buffer_size(4000),
+		packet_queue_chunk_size(16384),
+		drop_packets(false),
+		sequence_bits(16),
+		window_size(16),
+		stream_channels(1),
+		create_congestion_controller(&newreno_controller::create),
+		pace_sends(true),
+		coalesce_messages(false),
+		coalesce_time(1000),
+		max_message_size(65536),
+		reassembly_buffer_size(131072),
+		max_transmission_unit(1452),
+		discover_mtu(true),
+		fec_group_size(0),
+		fec_channels(0xFF),
+		batch_delivery(false)
+	{
+	}
+
+	// the most bytes of queued and unacknowledged messages each messenger may hold, the memory is taken
+	// in chunks of packet_queue_chunk_size bytes from a pool shared by every connection as it is needed
+	// and given back once drained. a message too large for a chunk is given memory of its own
+	size_t		stream_packet_queue_buffer_size;
+	size_t		reliable_packet_queue_buffer_size;
+	size_t		packet_queue_chunk_size;
+	bool		drop_packets;
+
+	// 16 or 32
+	uint32_t	sequence_bits;
+
+	// the amount of messages each messenger may have in flight
+	// a power of two no larger than maximum_window_size or half of the sequence space
+	uint32_t	window_size;
+
+	// independently ordered stream channels, a message lost on one channel only holds back that channel
+	// each channel has a packet queue buffer of stream_packet_queue_buffer_size bytes
+	uint32_t	stream_channels;
+
+	// called once for every connection, which takes ownership of the controller
+	congestion_controller_factory	create_congestion_controller;
+
+	// spread packets over the round trip at the rate the congestion controller allows
+	bool		pace_sends;
+
+	// pack small reliable and stream messages into shared packets, a packet is sent once it is full,
+	// coalesce_time microseconds after its first message or when network_session::flush is called
+	bool		coalesce_messages;
+	uint32_t	coalesce_time;
+
+	// reliable and stream messages larger than a packet are sent in fragments, up to max_message_size
+	// the sending side needs room for the whole message in its packet queue buffer, the receiving side
+	// reassembles at most reassembly_buffer_size bytes of messages at once on each channel
+	size_t		max_message_size;
+	size_t		reassembly_buffer_size;
+
+	// the largest datagram the session sends or receives, 1452 fits an ethernet frame under ipv6
+	// with discover_mtu every connection probes its way up from base_transmission_unit to the largest
+	// size its path carries, without it max_transmission_unit is used from the start
+	uint32_t	max_transmission_unit;
+	bool		discover_mtu;
+
+	// forward error correction, a parity packet follows every fec_group_size new messages sent on the
+	// stream channels set in the fec_channels bitmask, so the remote can rebuild one lost message of each
+	// group without waiting a round trip for the resend. 0 turns it off, the group is never larger than
+	// half the window. the redundancy is one parity packet for every fec_group_size messages, a group
+	// that hasn't filled up ack_delay_time after its first message is sent short so the tail of a burst
+	// is covered too
+	uint32_t	fec_group_size;
+	uint32_t	fec_channels;
+
+	// the messages received during an update are collected and handed to the handler in a single
+	// on_messages_received call at the end of receiving, instead of one on_message_received call each
+	bool		batch_delivery;
+
+	bool is_valid() const
+	{
+		if (create_congestion_controller == nullptr)
+			return false;
+
+		if (packet_queue_chunk_size == 0)
+			return false;
+
+		if (stream_channels == 0 || stream_channels > maximum_stream_channels)
+			return false;
+
+		if (max_message_size > (1u << 24) || reassembly_buffer_size < max_message_size)
+			return false;
+
+		if (max_transmission_unit < base_transmission_unit || max_transmission_unit > maximum_datagram_size)
+			return false;
+
+		if (fec_group_size > maximum_fec_group_size)
+			return false;
+
+		if (sequence_bits != 16 && sequence_bits != 32)
+			return false;
+
+		if (window_size == 0 || (window_size & (window_size - 1)) != 0 || window_size > maximum_window_size)
+			return false;
+
+		return sequence_bits == 32 || window_size <= (1u << (sequence_bits - 1));
+	}
+};
+
+// wraps sequence numbers at a negotiated bit width
+
+class sequence_space
+{
+public:
+	sequence_space() : _mask(0xFFFF), _bytes(2) { }
+
+	void create(uint32_t bits)
+	{
+		_bytes = bits / 8;
+		_mask = bits >= 32 ? ~((uint32_t)0) : ((1u << bits) - 1);
+	}
+
+	uint32_t bytes() const { return _bytes; }
+
+	uint32_t add(uint32_t number, uint32_t amount) const { return (number + amount) & _mask; }
+	uint32_t distance(uint32_t leading_number, uint32_t trailing_number) const { return (leading_number - trailing_number) & _mask; }
+
+	void write(bit_stream& stream, uint32_t number) const
+	{
+		if (_bytes == 2)
+			stream.fast_write<uint16_t>((uint16_t)number);
+		else
+			stream.fast_write<uint32_t>(number);
+	}
+	uint32_t read(bit_stream& stream) const
+	{
+		if (_bytes == 2)
+			return stream.fast_read<uint16_t>();
+		else
+			return stream.fast_read<uint32_t>();
+	}
+
+private:
+	uint32_t _mask;
+	uint32_t _bytes;
+};
+
+// one piece of a message that was too large for a single packet
+// every fragment but the last carries fragment_size bytes, so the offset follows from the index
+
+struct message_fragment
+{
+	// [2] fragment_index [2] fragment_count [4] message_length
+	static const uint32_t header_size = 8;
+
+	static uint32_t fragment_size(uint32_t message_length, uint32_t fragment_count) { return (message_length + fragment_count - 1) / fragment_count; }
+
+	uint32_t	index;
+	uint32_t	count;
+	uint32_t	message_length;
+
+	char*		data;
+	uint32_t	length;
+
+	uint32_t offset() const { return index * fragment_size(message_length, count); }
+
+	static void write_header(bit_stream& stream, uint32_t index, uint32_t count, uint32_t message_length)
+	{
+		stream.fast_write<uint16_t>((uint16_t)index);
+		stream.fast_write<uint16_t>((uint16_t)count);
+		stream.fast_write<uint32_t>(message_length);
+	}
+
+	// returns false if the fragment is malformed
+	bool read(char* buffer, size_t buffer_length)
+	{
+		if (buffer_length < header_size)
+			return false;
+
+		bit_stream stream(buffer, buffer_length);
+		index = stream.fast_read<uint16_t>();
+		count = stream.fast_read<uint16_t>();
+		message_length = stream.fast_read<uint32_t>();
+
+		data = buffer + header_size;
+		length = (uint32_t)(buffer_length - header_size);
+
+		if (count < 2 || index >= count || message_length < count)
+			return false;
+
+		// the last fragment gets what is left over, which has to be something
+
+		if ((uint64_t)fragment_size(message_length, count) * (count - 1) >= message_length)
+			return false;
+
+		return length == (index + 1 < count ? fragment_size(message_length, count) : message_length - offset());
+	}
+};
+
+/*
+ * puts fragmented messages back together, each into its own contiguous buffer
+ *
+ * messages are keyed by the id of their first fragment. the messages being assembled at once may take
+ * up at most buffer_size bytes, a fragment of a message that doesn't fit is refused and should be
+ * dropped without being acknowledged so the remote sends it again once there is room.
+ */
+class message_assembler
+{
+public:
+	message_assembler() : _max_message_size(0), _buffer_size(0), _buffered(0) { }
+
+	void create(size_t max_message_size, size_t buffer_size)
+	{
+		_max_message_size = max_message_size;
+		_buffer_size = buffer_size;
+		_buffered = 0;
+
+		_assemblies.clear();
+	}
+
+	bool can_accept(uint32_t first_id, const message_fragment& fragment) const
+	{
+		if (fragment.message_length > _max_message_size)
+			return false;
+
+		const assembly* a = find(first_id);
+
+		if (a != nullptr)
+			return a->message.size() == fragment.message_length && a->fragment_count == fragment.count;
+
+		return _buffered + fragment.message_length <= _buffer_size;
+	}
+
+	// copies the fragment in, returns the message once every fragment has arrived
+	// the message stays valid until it is released
+
+	std::vector<char>* add(uint32_t first_id, const message_fragment& fragment)
+	{
+		assembly* a = find(first_id);
+
+		if (a == nullptr)
+		{
+			if (!can_accept(first_id, fragment))
+				return nullptr;
+
+			_assemblies.push_back(assembly());
+			a = &_assemblies.back();
+
+			a->first_id = first_id;
+			a->fragment_count = fragment.count;
+			a->fragments_left = fragment.count;
+			a->message.resize(fragment.message_length);
+
+			_buffered += fragment.message_length;
+		}
+
+		memcpy(a->message.data() + fragment.offset(), fragment.data, fragment.length);
+
+		--a->fragments_left;
+
+		return a->fragments_left == 0 ? &a->message : nullptr;
+	}
+	void release(uint32_t first_id)
+	{
+		for (size_t i = 0; i < _assemblies.size(); ++i)
+		{
+			if (_assemblies[i].first_id == first_id)
+			{
+				_buffered -= _assemblies[i].message.size();
+
+				std::swap(_assemblies[i], _assemblies.back());
+				_assemblies.pop_back();
+				return;
+			}
+		}
+	}
+
+private:
+	struct assembly
+	{
+		uint32_t			first_id;
+		uint32_t			fragment_count;
+		uint32_t			fragments_left;
+		std::vector<char>	message;
+	};
+
+	assembly* find(uint32_t first_id)
+	{
+		for (size_t i = 0; i < _assemblies.size(); ++i)
+		{
+			if (_assemblies[i].first_id == first_id)
+				return &_assemblies[i];
+		}
+
+		return nullptr;
+	}
+	const assembly* find(uint32_t first_id) const { return const_cast<message_assembler*>(this)->find(first_id); }
+
+	size_t	_max_message_size;
+	size_t	_buffer_size;
+	size_t	_buffered;
+
+	std::vector<assembly>	_assemblies;
+};
+
+// smoothed round trip time and its variance, kept per connection and used to time resends
+// follows rfc 6298, all times are in microseconds
+
+class rtt_estimator
+{
+public:
+	// used until the first sample arrives
+	static const uint64_t initial_timeout = 100000;
+
+	static const uint64_t minimum_timeout = 5000;
+	static const uint64_t maximum_timeout = 2000000;
+
+	rtt_estimator() { reset(); }
+
+	void reset()
+	{
+		_smoothed_rtt = 0;
+		_rtt_variance = 0;
+		_latest_rtt = 0;
+		_has_sample = false;
+	}
+
+	void add_sample(uint64_t rtt)
+	{
+		_latest_rtt = rtt;
+
+		if (!_has_sample)
+		{
+			_smoothed_rtt = rtt;
+			_rtt_variance = rtt / 2;
+			_has_sample = true;
+			return;
+		}
+
+		uint64_t error = rtt > _smoothed_rtt ? rtt - _smoothed_rtt : _smoothed_rtt - rtt;
+
+		_rtt_variance = (3 * _rtt_variance + error) / 4;
+		_smoothed_rtt = (7 * _smoothed_rtt + rtt) / 8;
+	}
+
+	bool has_sample() const { return _has_sample; }
+
+	uint64_t smoothed_rtt() const { return _smoothed_rtt; }
+	uint64_t rtt_variance() const { return _rtt_variance; }
+	uint64_t latest_rtt() const { return _latest_rtt; }
+
+	// doubles for every backoff step, a messenger backs off each time its resend timer fires unanswered
+
+	uint64_t retransmission_timeout(uint32_t backoff = 0) const
+	{
+		uint64_t timeout = _has_sample ? _smoothed_rtt + 4 * _rtt_variance : initial_timeout;
+
+		timeout = (timeout < minimum_timeout ? minimum_timeout : timeout) << std::min<uint32_t>(backoff, 16);
+
+		return timeout > maximum_timeout ? maximum_timeout : timeout;
+	}
+
+	// how long the last packets of a burst may go unacknowledged before a tail loss probe, as in rfc 8985
+	uint64_t probe_timeout() const
+	{
+		uint64_t timeout = 2 * _smoothed_rtt;
+
+		return timeout < minimum_timeout ? minimum_timeout : timeout;
+	}
+
+private:
+	uint64_t	_smoothed_rtt;
+	uint64_t	_rtt_variance;
+	uint64_t	_latest_rtt;
+	bool		_has_sample;
+};
+
+struct connection_stats
+{
+	// zero until the first round trip has been measured
+	uint64_t	smoothed_rtt;
+	uint64_t	rtt_variance;
+	uint64_t	latest_rtt;
+
+	uint64_t	retransmission_timeout;
+
+	// packets, summed over the reliable and stream channels
+	uint32_t	congestion_window;
+	uint32_t	packets_in_flight;
+
+	// the largest packet confirmed to reach the remote
+	uint32_t	path_mtu;
+
+	// messages waiting in the reliable and stream send queues, and the bytes of the packet queue buffers
+	// taken by them and by the messages waiting to be acknowledged
+	uint32_t	queued_messages;
+	size_t		queued_bytes;
+
+	// forward error correction on the stream channels, the parity packets sent for the messages they
+	// protect and the messages rebuilt from the parity the remote sent
+	uint32_t	parity_packets_sent;
+	uint32_t	messages_recovered;
+	float		fec_redundancy;
+};
+
+// refers to a connection by its slot instead of its uuid, so using it skips the uuid lookup
+// a handle goes stale once its connection is gone and is then ignored by the session
+
+class connection_handle
+{
+public:
+	connection_handle()
+	{
+		_slot.index = slot_map<int>::invalid_index;
+		_slot.generation = 0;
+	}
+
+	bool is_nil() const { return _slot.index == slot_map<int>::invalid_index; }
+
+	bool operator==(const connection_handle& rhs) const { return _slot.index == rhs._slot.index && _slot.generation == rhs._slot.generation; }
+	bool operator!=(const connection_handle& rhs) const { return !(*this == rhs); }
+
+private:
+	friend class network_session;
+
+	explicit connection_handle(const slot_handle& slot) : _slot(slot) { }
+
+	slot_handle _slot;
+};
+
+struct received_message
+{
+	bit_stream			message;
+	uuid				id;
+	connection_handle	handle;
+
+	// when the datagram carrying the message, or its last fragment, was read off the socket
+	uint64_t			receive_time;
 };
 
 class network_session_handler
 {
 public:
+	// the message is only valid during the call unless it is kept with network_session::retain_message
 	virtual void on_message_received(bit_stream, const uuid&) = 0;
+
+	// used instead of on_message_received with network_session_config::batch_delivery, the messages are in
+	// the order they were received and valid during the call unless kept with network_session::retain_message
+	virtual void on_messages_received(received_message*, size_t) { }
 	virtual void on_peer_joined(const uuid&) = 0;
 	virtual void on_peer_disconnected(const uuid&) = 0;
 	virtual void query_result_handler(const ip_address&, bool, bool, uint32_t, uint32_t) = 0;
 	virtual void connect_result_handler(const uuid&, bool, uint32_t) = 0;
+
+	// called when a peer joins, along with the handle it can be addressed by from then on
+	// the default passes the uuid on to on_peer_joined, a handler that keeps handles overrides this
+	virtual void on_peer_joined(const uuid& id, connection_handle) { on_peer_joined(id); }
+
+	// a send to the peer returned send_result_would_block and the packet queue buffer has room again
+	virtual void on_send_ready(const uuid&, connection_handle) { }
 };
 
 class network_session
 {
 public:
-	static const uint32_t maximum_transmission_unit = 800;
-
-	static const uint32_t resend_time = 100000;
 	static const uint32_t ping_time = 1000000;
+	static const uint32_t ack_delay_time = 5000;
 	static const uint32_t timeout_time = 10000000;
 
-	static const uint32_t protocol_version = 0x33366999;
+	// how long a connection keeps its path mtu before probing for a larger one again
+	static const uint32_t mtu_raise_time = 600000000;
+
+	// sequenced messages are ordered separately on each of these channels
+	static const uint32_t sequenced_channels = 16;
+
+	// one send queue for each message_priority
+	static const uint32_t priority_levels = 3;
+
+	// the packet queue chunks the session allocates at once whenever every one is in use
+	static const uint32_t packet_queue_pool_growth = 16;
+
+	static const uint32_t protocol_version = 0x333669A1;
 
 	network_session();
 	~network_session();
@@ -148,18 +725,95 @@ public:
 		size_t reliable_packet_queue_buffer_size = 4000,
 		bool drop_packets = false
 		);
+	bool create(
+		const char* port_number,
+		uint32_t password,
+		uint32_t max_connections,
+		network_session_handler* handler,
+		const network_session_config& config
+		);
 	void destroy();
 
-	void send_unreliable(const char* buffer, const uint32_t length, uuid id);
-	void send_reliable(const char* buffer, const uint32_t length, uuid id);
-	void send_stream(const char* buffer, const uint32_t length, uuid id);
+	// send_result_would_block means the packet queue buffer has no room for the message right now, the
+	// handler's on_send_ready is called once acknowledgments or expired messages free some up
+	// unreliable and sequenced messages aren't queued, they would block when the socket turns them down
+	// send_result_invalid means the message is too large, or the stream channel or priority doesn't exist
+	//
+	// a reliable or stream message waits in the queue for its priority, a message that is still queued
+	// lifetime microseconds after the call is dropped instead of sent, 0 keeps it until it is sent
+	// the messages on a stream channel are delivered in the order they are sent, which follows the
+	// order of the calls only among messages of the same priority
+
+	send_result send_unreliable(const char* buffer, const uint32_t length, uuid id);
+	send_result send_reliable(const char* buffer, const uint32_t length, uuid id, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result send_stream(const char* buffer, const uint32_t length, uuid id, uint32_t channel = 0, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+
+	send_result send_unreliable(const char* buffer, const uint32_t length, connection_handle handle);
+	send_result send_reliable(const char* buffer, const uint32_t length, connection_handle handle, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result send_stream(const char* buffer, const uint32_t length, connection_handle handle, uint32_t channel = 0, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+
+	// unreliable, but a message older than the newest one received on its channel is dropped
+
+	send_result send_sequenced(const char* buffer, const uint32_t length, uuid id, uint32_t channel = 0);
+	send_result send_sequenced(const char* buffer, const uint32_t length, connection_handle handle, uint32_t channel = 0);
+
+	// reliable, but a message that is still unacknowledged when a newer one is sent for the same key
+	// is never resent or delivered, for state where only the latest value matters
+	// it has to fit a single packet and is never coalesced
+
+	send_result send_reliable_latest(const char* buffer, const uint32_t length, uuid id, uint32_t key, message_priority priority = message_priority_normal);
+	send_result send_reliable_latest(const char* buffer, const uint32_t length, connection_handle handle, uint32_t key, message_priority priority = message_priority_normal);
+
+	// reliable and stream messages written in place, reserve points stream at room for up to length bytes
+	// in the packet queue buffer, commit queues the message with the stream.tell() bytes written to it
+	// the message has to fit a single packet and is never coalesced, it is queued behind whatever was sent
+	// before the commit. each channel holds one reservation, reserving again gives the previous one up
+
+	send_result reserve_reliable(bit_stream* stream, const uint32_t length, uuid id, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result reserve_reliable(bit_stream* stream, const uint32_t length, connection_handle handle, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result commit_reliable(bit_stream& stream, uuid id);
+	send_result commit_reliable(bit_stream& stream, connection_handle handle);
+
+	send_result reserve_stream(bit_stream* stream, const uint32_t length, uuid id, uint32_t channel = 0, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result reserve_stream(bit_stream* stream, const uint32_t length, connection_handle handle, uint32_t channel = 0, message_priority priority = message_priority_normal, uint64_t lifetime = 0);
+	send_result commit_stream(bit_stream& stream, uuid id, uint32_t channel = 0);
+	send_result commit_stream(bit_stream& stream, connection_handle handle, uint32_t channel = 0);
 	
+	// keeps a message passed to on_message_received valid past the call, until release_message is called
+	// with the stream returned or the session is destroyed. a message that arrived in a single datagram is
+	// kept by reference to the buffer it was received into, a reassembled message is copied
+
+	bit_stream retain_message(bit_stream& message);
+	void release_message(bit_stream& message);
+
 	void update();
 
+	// sends the packets small messages are being coalesced into without waiting for coalesce_time
+	void flush();
+
+	// the time on the session clock, in microseconds, that the next send, resend, ping or timeout is due
+	// returns network_waiter::no_deadline when nothing is scheduled
+
+	uint64_t next_deadline();
+	uint64_t current_time() { return _timer.get_microseconds(); }
+
+	// blocks until a datagram arrives, the next deadline is due or max_wait microseconds pass
+
+	bool wait(uint64_t max_wait);
+	void wait_and_update(uint64_t max_wait);
+
+	// wait in two halves for a session shared between threads. wait_deadline flushes the send batch and
+	// reads every connection so it needs the lock update runs under, wait_until only blocks on the socket
+	// and can run without it
+
+	uint64_t wait_deadline(uint64_t max_wait);
+	bool wait_until(uint64_t deadline);
+
 	void query(const ip_address& addr);
 
 	void try_connect(const ip_address& addr, uint32_t password);
 	void disconnect(uuid id);
+	void disconnect(connection_handle handle);
 
 	uuid find_id(const ip_address& addr)
 	{
@@ -170,18 +824,55 @@ public:
 		else
 			return uuid();
 	}
+	connection_handle find_handle(const uuid& id)
+	{
+		connection* con = find_connection(id);
+
+		if (con)
+			return connection_handle(con->slot());
+		else
+			return connection_handle();
+	}
 	const uuid& local_id() const { return _uuid; }
 
+	// round trip and congestion estimates for a connection, returns false if it is not connected
+
+	bool get_connection_stats(uuid id, connection_stats* stats);
+	bool get_connection_stats(connection_handle handle, connection_stats* stats);
+
 private:
-	
+	// fills a session with connections to time find_connection
+	friend class lookup_benchmark;
+
 	struct packet
 	{
 	public:
-		packet() : buffer(nullptr), buffer_length(0) { }
+		packet() : buffer(nullptr), buffer_length(0), allocation(nullptr), messages(0), expiry_time(0), superseded(false), send_time(0), resent(false), acknowledged(false) { }
 
 		char*		buffer;
 		size_t		buffer_length;
 
+		// the allocation to release once the packet is acknowledged or dropped
+		// the fragments of a message share one allocation, only the last one has it
+		char*		allocation;
+
+		// the messages done with once the packet is sent, a coalesced packet carries several and a
+		// fragmented message is counted by its last fragment
+		uint32_t	messages;
+
+		// when the packet is dropped if it is still queued, 0 if it never is
+		uint64_t	expiry_time;
+
+		// set on a queued latest message once a newer one for its key is sent, it is dropped unsent
+		bool		superseded;
+
+		// when the packet was first sent, only packets that were never resent give rtt samples
+		uint64_t	send_time;
+		bool		resent;
+
+		// set when the remote has selectively acknowledged a packet still in the window
+		bool		acknowledged;
+
 		bit_stream get_stream() { return bit_stream(buffer, buffer_length); }
 	};
 
@@ -189,147 +880,404 @@ private:
 	{
 	public:
 		connection();
-		connection(const connection& rhs);
-		connection(connection&& rhs);
-		const connection& operator=(connection rhs);
+		~connection();
+
+		// connections live in a slot_map and never move, the messengers keep pointers back to them
+
+		connection(const connection& rhs) = delete;
+		connection& operator=(const connection& rhs) = delete;
 
 		const ip_address& remote_address() const { return _remote_address; }
 		const uuid& remote_uuid() const { return _remote_uuid; }
+		const slot_handle& slot() const { return _slot; }
 		bool is_disconnected() const { return _disconnected; }
 
-		void create(network_session* session, const ip_address& remote_address, const uuid& remote_uuid, size_t stream_packet_queue_buffer_size = 4000, size_t reliable_packet_queue_buffer_size = 4000);
+		// the largest packet the messengers may send
+		uint32_t mtu() const { return _mtu; }
+
+		void create(network_session* session, const slot_handle& slot, const ip_address& remote_address, const uuid& remote_uuid, uint32_t sequence_bits, uint32_t window_size, uint32_t stream_channels);
 
 		void receive_message(packet* msg, uint64_t current_time);
 
-		void send_unreliable(const char* buffer, const uint32_t length);
-		void send_stream(const char* buffer, const uint32_t length);
-		void send_reliable(const char* buffer, const uint32_t length);
+		send_result send_unreliable(const char* buffer, const uint32_t length);
+		send_result send_stream(const char* buffer, const uint32_t length, uint32_t channel, message_priority priority, uint64_t lifetime);
+		send_result send_reliable(const char* buffer, const uint32_t length, message_priority priority, uint64_t lifetime);
+		send_result send_sequenced(const char* buffer, const uint32_t length, uint32_t channel);
+		send_result send_reliable_latest(const char* buffer, const uint32_t length, uint32_t key, message_priority priority);
+
+		send_result reserve_stream(bit_stream* stream, const uint32_t length, uint32_t channel, message_priority priority, uint64_t lifetime);
+		send_result reserve_reliable(bit_stream* stream, const uint32_t length, message_priority priority, uint64_t lifetime);
+		send_result commit_stream(bit_stream& stream, uint32_t channel);
+		send_result commit_reliable(bit_stream& stream);
 
 		void update(uint64_t current_time);
+		uint64_t next_deadline(uint64_t current_time) const;
+
+		// closes any packets being coalesced into and sends what the congestion window and pacer allow
+		void flush(uint64_t current_time);
+
+		void get_stats(connection_stats* stats) const;
+
+		// calls on_send_ready if a messenger has freed room since a send was turned down, the session calls
+		// it once the datagram or update that may have freed it is done with, as the handler may disconnect
+		void notify_send_ready();
 
 	private:
-		static void swap(connection& a, connection& b);
+		// the acknowledgment state of every messenger, carried by ping and ping_response
+
+		void write_status(bit_stream& stream);
+		bool read_status(bit_stream& stream, uint64_t current_time);
+
+		// path mtu discovery after rfc 8899, a ping padded out to the probed size goes out every ping_time
+		// while searching. each size gets max_mtu_probes tries, the search halves the range between the
+		// confirmed mtu and the smallest size known to fail until it is narrower than mtu_search_step
+
+		void send_ping(uint64_t current_time);
+		void on_probe_lost();
+		void on_probe_acknowledged(uint64_t current_time);
+		uint32_t next_probe_size(uint64_t current_time);
+
+		static const uint32_t max_mtu_probes = 3;
+		static const uint32_t mtu_search_step = 32;
+
+		// black hole detection, a messenger whose oldest packet is larger than base_transmission_unit and
+		// has timed out black_hole_timeouts times in a row reports it. the path is taken to have shrunk, the
+		// mtu falls back to base_transmission_unit and the search starts over
+
+		void on_black_hole(uint64_t current_time);
+
+		static const uint32_t black_hole_timeouts = 3;
+
+		// sends a packet of a messenger, one built for an mtu larger than the current one goes out in parts
+		// that the remote puts back together before taking it in
+
+		void send_packet(const char* buffer, size_t length);
+		void receive_split(bit_stream& stream, uint64_t current_time);
 
-		class stream_messenger
+		// [1] header + [2] split_id + the header of a message fragment
+		static const uint32_t split_header_size = 3 + message_fragment::header_size;
+
+		// congestion control and pacing are shared by the messengers, new packets are only sent while can_send is true
+		// every packet sent, new or resent, is reported through on_packet_sent
+
+		uint32_t packets_in_flight() const;
+
+		// the latest acknowledgment received on any channel
+		uint64_t last_ack_time() const;
+		bool is_congestion_limited() const { return packets_in_flight() >= _congestion->congestion_window(); }
+		bool can_send(uint64_t current_time) const { return !is_congestion_limited() && _pacer.can_send(current_time); }
+
+		uint64_t pacing_interval() const;
+		void on_packet_sent(uint64_t current_time) { _pacer.on_packet_sent(current_time, pacing_interval()); }
+
+		void send_queued(uint64_t current_time);
+
+		void on_packets_acknowledged(uint32_t acknowledged, uint64_t newest_send_time, uint64_t rtt_sample, uint64_t current_time);
+
+		// the most ranges of out of order messages reported by one [ack] block
+		static const uint32_t max_ack_ranges = 16;
+		static const uint32_t max_ack_size = 4 + 1 + max_ack_ranges * 4;
+
+		// a message counts as lost once this many messages sent after it have been acknowledged
+		static const uint32_t loss_threshold = 3;
+
+		// acks wait up to ack_delay_time for a message to piggyback on, unless this many messages are waiting on them
+		static const uint32_t ack_frequency = 2;
+
+		// the window, acknowledgments and send queues shared by the reliable channel and every stream channel
+		// a packet starts with the type, followed by the channel on a stream channel, and then its sequence numbers
+
+		class messenger
 		{
 		public:
-			stream_messenger();
-
-			static const uint32_t maximum_sequence_number = 255;
-			static const uint32_t window_size = 16;
+			messenger();
+			virtual ~messenger() { }
 
-			static uint32_t modulus_distance(uint8_t leading_number, uint8_t trailing_number)
-			{
-				if (leading_number < trailing_number)
-				{
-					return 1 + leading_number + (stream_messenger::maximum_sequence_number - trailing_number);
-				}
-				else
-				{
-					return leading_number - trailing_number;
-				}
-			}
+			// [type] + [s] message_id + [s] next_desired_message
+			uint32_t header_size() const { return _type_size + 2 * _sequence.bytes(); }
 
-			uint8_t local_low_n_sent() const { return _local_low_n_sent; }
-			uint8_t local_low_n_received() const { return _local_low_n_received; }
+			uint32_t local_low_n_sent() const { return _local_low_n_sent; }
+			uint32_t in_flight() const { return _sequence.distance(_local_low_n_sent, _remote_low_n_received); }
+			uint32_t local_low_n_received() const { return _local_low_n_received; }
 			uint64_t last_ack_time() const { return _last_ack_time; }
+			uint32_t queued_messages() const { return _queued_messages; }
+			size_t queued_bytes() const { return _allocator.size(); }
 
-			void set_connection(network_session::connection* connection) { _connection = connection; }
 			void set_session(network_session* session) { _session = session; }
 
-			void create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size);
-			void receive_ack(uint8_t new_rnd, uint64_t current_time);
-			void receive_message(bit_stream& stream, uint64_t current_time);
-			void send(const char* buffer, const uint32_t length);
+			void receive_ack(uint32_t new_rnd, uint64_t current_time, bool sample_rtt);
+			send_result send(const char* buffer, const uint32_t length, uint32_t priority, uint64_t lifetime);
+
+			// a message written in place, reserve points stream at room for length bytes after the header
+			// and commit queues it with the bytes written
+			send_result reserve(bit_stream* stream, const uint32_t length, uint32_t priority, uint64_t lifetime);
+			send_result commit(char* data, size_t length);
+
+			// closes the packet messages are being coalesced into so it can be sent
+			void flush();
+
+			// update handles resends, send_next moves one message queued at the priority into the window if it may be sent
+
 			void update(uint64_t current_time);
+			bool send_next(uint64_t current_time, uint32_t priority);
+			uint64_t next_deadline(uint64_t current_time) const;
 
-		private:
-			
-			void resend_message(uint32_t seq);
+			// writes and reads an [ack] block, read_ack returns false if the block is malformed
+			// writing one satisfies any ack waiting to be sent
+			// sample_rtt is false for acks that may have been held back, like the ones carried by ping
+
+			void write_ack(bit_stream& stream);
+			bool read_ack(bit_stream& stream, uint64_t current_time, bool sample_rtt);
+
+		protected:
+			// type and ack_type are the message types of the messenger's packets and acks, the channel is
+			// only written after them with a type_size of 2
+			void create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size, uint8_t type, uint8_t ack_type, uint32_t type_size, uint8_t channel);
+
+			// called once a queued packet has taken its message id and been sent, and for every queued
+			// packet dropped before it was
+			virtual void on_sent(uint32_t, const packet&, uint64_t) { }
+			virtual void on_dropped(const packet&) { }
+
+			// the type bytes, written when a message is queued
+			void write_type(char* buffer, uint8_t flags) const;
+
+			// the largest packet queued, _packet_reserve bytes of the mtu are kept free
+			uint32_t max_packet_size() const { return _connection->mtu() - _packet_reserve; }
+
+			void resend_message(uint32_t seq, uint64_t current_time);
+
+			// the remote may hold its ack back for up to ack_delay_time, so the timeout has to allow for it
+			uint64_t resend_timeout() const { return _connection->_rtt.retransmission_timeout(_resend_backoff) + network_session::ack_delay_time; }
+
+			// one probe per burst, only once the round trip is known and while the resend timer hasn't fired
+			bool can_probe_tail() const { return !_tail_probe_sent && _resend_backoff == 0 && _connection->_rtt.has_sample(); }
+			uint64_t tail_probe_timeout() const { return _connection->_rtt.probe_timeout() + network_session::ack_delay_time; }
+
+			send_result coalesce(const char* buffer, const uint32_t length, uint32_t priority, uint64_t expiry_time);
+			send_result send_fragmented(const char* buffer, const uint32_t length, uint32_t priority, uint64_t expiry_time);
+
+			// would_block unless the allocation couldn't fit even an empty packet queue buffer
+			send_result allocation_failed(size_t size);
+
+			// drops the expired and superseded messages at the front of a queue, a message is only dropped
+			// before its first packet is sent and takes the rest of its fragments with it
+			void drop_expired(uint32_t priority, uint64_t current_time);
+			size_t queued_packets() const;
+
+			// gives an allocation back and lets the connection know if a send was waiting for room
+			void release(char* allocation);
+
+			// hands the messages in a packet received in order to the session, unpacking frames and
+			// assembling fragments
+			void deliver(uint32_t message_id, char* packet, size_t packet_length);
+
+			void schedule_ack(bool immediately, uint64_t current_time);
+			void send_ack();
+			void piggyback_ack();
 
 			network_session*				_session;
 			network_session::connection*	_connection;
 
-			uint8_t		_local_low_n_sent;
-			uint8_t		_local_low_n_received;
-			uint8_t		_remote_low_n_received;
+			uint8_t			_type;
+			uint8_t			_ack_type;
+			uint32_t		_type_size;
+			uint8_t			_channel;
+			uint32_t		_packet_reserve;
+
+			sequence_space	_sequence;
+			uint32_t		_window_size;
+
+			uint32_t	_local_low_n_sent;
+			uint32_t	_local_low_n_received;
+
+			// the furthest message received past _local_low_n_received, as a distance from it
+			uint32_t	_local_high_n_distance;
+
+			uint32_t	_remote_low_n_received;
 
 			uint64_t _last_ack_time;
 			uint64_t _last_resend_time;
+			uint32_t _resend_backoff;
+			bool	 _tail_probe_sent;
 
-			circular_allocator	_allocator;
+			bool		_ack_pending;
+			uint64_t	_ack_deadline;
+			uint32_t	_received_since_ack;
 
-			packet				_window[window_size];
-			std::queue<packet>	_queue;
+			message_assembler	_assembler;
+
+			// set while the last packet queued at _coalesce_priority is still open for more messages
+			bool		_coalescing;
+			uint32_t	_coalesce_priority;
+			uint64_t	_coalesce_deadline;
+
+			segmented_allocator	_allocator;
+
+			// the messages in the queues, and whether a send was turned down since room was last freed
+			uint32_t	_queued_messages;
+			bool		_send_blocked;
+
+			// the packet a message is being written into in place, its buffer is null while nothing is reserved
+			packet		_reserved;
+			uint32_t	_reserved_priority;
+
+			// indexed by sequence number modulo the window size
+			std::vector<packet>		_window;
+			std::vector<uint8_t>	_received;
+
+			ring_queue<packet>		_queues[network_session::priority_levels];
 		};
 
-		class reliable_messenger
+		class stream_messenger : public messenger
 		{
 		public:
-			reliable_messenger();
+			stream_messenger();
+			~stream_messenger();
 
-			static const uint32_t maximum_sequence_number = 255;
-			static const uint32_t window_size = 16;
+			void create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size, uint8_t channel);
+			void receive_message(bit_stream& stream, uint64_t current_time);
+			void receive_parity(bit_stream& stream, uint64_t current_time);
 
-			static uint32_t modulus_distance(uint8_t leading_number, uint8_t trailing_number)
-			{
-				if (leading_number < trailing_number)
-				{
-					return 1 + leading_number + (reliable_messenger::maximum_sequence_number - trailing_number);
-				}
-				else
-				{
-					return leading_number - trailing_number;
-				}
-			}
+			// also send the parity of a group that is still short when its deadline passes
+			void update(uint64_t current_time);
+			uint64_t next_deadline(uint64_t current_time) const;
 
-			uint8_t local_low_n_sent() const { return _local_low_n_sent; }
-			uint8_t local_low_n_received() const { return _local_low_n_received; }
-			uint16_t local_messages_received() const { return _local_messages_received; }
-			uint64_t last_ack_time() const { return _last_ack_time; }
+			uint32_t parity_packets_sent() const { return _parity_packets_sent; }
+			uint32_t messages_protected() const { return _messages_protected; }
+			uint32_t messages_recovered() const { return _messages_recovered; }
 
-			void set_connection(network_session::connection* connection) { _connection = connection; }
-			void set_session(network_session* session) { _session = session; }
+		private:
+			// [1] header + [1] channel + [s] first_message_id + [1] message_count + [2] length
+			uint32_t parity_header_size() const { return 5 + _sequence.bytes(); }
+
+			// takes in a message received or rebuilt from parity
+			void accept_message(uint32_t message_id, char* packet, size_t packet_length, uint64_t current_time);
+
+			// xors each message sent into the parity of its group, which is sent once the group is full
+			void on_sent(uint32_t message_id, const packet& p, uint64_t current_time) override;
+			void send_parity(uint64_t current_time);
+
+			// a fragment is only taken in if its message isn't larger than max_message_size
+			bool can_accept(char* packet, size_t packet_length);
+
+			// messages that arrived past a gap, held until they can be delivered in order
+			// each one retains the receive buffer it arrived in, a null buffer marks an empty slot
+			std::vector<packet>		_buffered;
+
+			// the group of messages the parity is being built for, it is sent at _fec_deadline if it isn't full by then
+			uint32_t			_fec_group_size;
+			uint32_t			_fec_first;
+			uint32_t			_fec_count;
+			uint64_t			_fec_deadline;
+			uint32_t			_fec_length;
+			size_t				_fec_size;
+			std::vector<char>	_fec_parity;
+
+			// the protected bytes of the messages received, indexed like the window, kept from the first
+			// parity packet the remote sends on
+			bool							_fec_active;
+			std::vector<std::vector<char>>	_fec_history;
+			std::vector<uint32_t>			_fec_history_id;
+
+			uint32_t	_parity_packets_sent;
+			uint32_t	_messages_protected;
+			uint32_t	_messages_recovered;
+		};
 
-			void create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size);
-			void receive_ack(uint8_t new_rnd, uint16_t new_status, uint64_t current_time);
+		class reliable_messenger : public messenger
+		{
+		public:
+			void create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size);
 			void receive_message(bit_stream& stream, uint64_t current_time);
-			void send(const char* buffer, const uint32_t length);
-			void update(uint64_t current_time);
 
-		private:
+			// queues a message that replaces any unacknowledged message sent for the same key
+			send_result send_latest(const char* buffer, const uint32_t length, uint32_t key, uint32_t priority);
 
-			void resend_message(uint32_t seq);
+		private:
+			// a reliable latest message is found by its message id once it is sent, and forgotten if it
+			// is dropped before that
+			void on_sent(uint32_t message_id, const packet& p, uint64_t current_time) override;
+			void on_dropped(const packet& p) override;
 
-			network_session*				_session;
-			network_session::connection*	_connection;
+			// a fragment is only taken in if the assembler has room for its message
+			bool can_accept(uint32_t message_id, char* packet, size_t packet_length);
 
-			uint8_t		_local_low_n_sent;
-			uint8_t		_local_low_n_received;
-			uint16_t	_local_messages_received;
+			// delivers a reliable latest message unless a newer one for its key came first
+			void deliver(uint32_t message_id, char* packet, size_t packet_length);
 
-			uint8_t		_remote_low_n_received;
-			uint16_t	_remote_messages_received;
+			// forgets the newest message delivered for keys whose id has fallen more than a window behind,
+			// any message still to come is newer, and the id would be misread once the sequence wraps
+			void prune_latest_received();
 
-			uint64_t _last_ack_time;
-			uint64_t _last_resend_time;
+			// cuts a reliable latest message for the key down to nothing, it keeps its message id
+			void supersede(packet& p, uint32_t key);
 
-			circular_allocator	_allocator;
+			// the key of a reliable latest message that hasn't been superseded
+			bool latest_key(const packet& p, uint32_t* key) const;
 
-			packet				_window[window_size];
-			std::queue<packet>	_queue;
+			// the newest reliable latest message for each key, while it is queued it is found by its index in
+			// the queue for its priority and once it is sent by its message id
+			struct latest_message
+			{
+				bool		queued;
+				uint32_t	priority;
+				uint32_t	queue_index;
+				uint32_t	message_id;
+			};
+
+			// the newest reliable latest message sent and the message id of the newest delivered for each key
+			std::unordered_map<uint32_t, latest_message>	_latest_sent;
+			std::unordered_map<uint32_t, uint32_t>			_latest_received;
 		};
 
+		static const uint32_t max_status_size = (network_session_config::maximum_stream_channels + 1) * max_ack_size;
+		static const uint32_t max_ping_size = 1 + 8 + max_status_size + 2;
+
 		network_session*	_session;
 
+		slot_handle			_slot;
 		ip_address			_remote_address;
 		uuid				_remote_uuid;
 
 		uint64_t			_last_ping_time;
+		rtt_estimator		_rtt;
+
+		congestion_controller*	_congestion;
+		send_pacer				_pacer;
+
+		uint32_t			_mtu;
+
+		// the largest size that may still get through and the size being probed, 0 once the search is done
+		uint32_t			_mtu_search_high;
+		uint32_t			_probe_size;
+		uint32_t			_probe_failures;
+		bool				_probe_outstanding;
+		uint64_t			_probe_ping_time;
+		uint64_t			_mtu_raise_deadline;
+
+		// the id of the last packet sent in parts, and the packet whose parts are being received into a
+		// block from the receive pool, only the newest one is put together
+		uint16_t				_split_sent;
+		char*					_split_block;
+		uint16_t				_split_id;
+		uint32_t				_split_length;
+		uint32_t				_split_remaining;
+		std::vector<uint8_t>	_split_parts;
+
+		// the last sequence sent and received on each sequenced channel
+		uint16_t			_sequenced_sent[network_session::sequenced_channels];
+		uint16_t			_sequenced_received[network_session::sequenced_channels];
+
+		// one for each stream channel
+		stream_messenger*	_stream_messengers;
+		uint32_t			_stream_channel_count;
 
-		stream_messenger	_stream_messenger;
 		reliable_messenger	_reliable_messenger;
 
+		// set when a messenger that turned a send down has freed room
+		bool				_send_ready;
+
 		bool				_disconnected;
 	};
 
@@ -339,24 +1287,61 @@ private:
 	uint32_t				_password;
 
 	uint32_t				_max_connections;
-	std::vector<connection>	_connections;
-	size_t					_stream_packet_queue_buffer_size;
-	size_t					_reliable_packet_queue_buffer_size;
+	slot_map<connection>	_connections;
+
+	std::unordered_map<ip_address, uint32_t>	_connections_by_address;
+	std::unordered_map<uuid, uint32_t>			_connections_by_uuid;
+
+	network_session_config	_config;
 
 	network_session_handler*	_handler;
 	network_timer				_timer;
 	udp_socket					_socket;
-	packet						_receive_packet;
+	network_waiter				_waiter;
+
+	// datagrams are received straight into blocks from the pool, a block is handed back once nothing retains it
+	buffer_pool					_receive_pool;
+	char*						_receive_blocks[udp_socket::batch_size];
+
+	// the chunks every messenger's packet queue is built from
+	buffer_pool					_packet_queue_pool;
+
+	// retained messages that were copied out of the pool, by reference count
+	std::unordered_map<char*, uint32_t>	_retained_copies;
+
+	// with batch_delivery each message received retains its buffer until the batch is handed over
+	std::vector<received_message>	_received_batch;
+	uint64_t						_receive_time;
+
+	// mtu probes are padded out in here, it is zeroed and as large as the largest probe
+	char*						_probe_buffer;
+
+	// sequenced messages are put together in here before being queued on the socket
+	char*						_send_buffer;
+	size_t						_receive_lengths[udp_socket::batch_size];
+	ip_address					_receive_addresses[udp_socket::batch_size];
 
 	// functions
 
 	connection* find_connection(const ip_address& addr);
 	connection* find_connection(const uuid& id);
+	connection* find_connection(connection_handle handle) { return _connections.get(handle._slot); }
+
+	connection* add_connection(const ip_address& addr, const uuid& id, const network_session_config& negotiated);
+	void remove_connection(connection* con);
 
 	void update_connections();
 
 	void receive_packets();
 	void handle_unconnected_packet(packet* msg, const ip_address& remote_addr);
+
+	// returns where the retained bytes are, the same buffer unless it had to be copied
+	char* retain_buffer(char* buffer, size_t length);
+	void release_buffer(char* buffer);
+
+	// hands a message received from con to the handler, or adds it to the batch
+	void deliver_message(connection* con, char* buffer, size_t length);
+	void deliver_batch();
 	
 };
 
@@ -0,0 +1,101 @@
+#ifndef onyx_ring_queue_h
+#define onyx_ring_queue_h
+
+#include <stdint.h>
+
+/*
+ * a first in first out queue of T's in a single power of two sized array
+ *
+ * every element pushed is numbered by a running 32 bit index, the element with index i lives at
+ * i & (capacity - 1) so pushing and popping never moves anything. a full queue doubles its array,
+ * keeping every element at its index, and never shrinks, so a queue that has seen its deepest
+ * backlog stops allocating. the index of an element stays valid until that element is popped.
+ */
+template<class T>
+class ring_queue
+{
+public:
+	ring_queue() : _items(nullptr), _mask(0), _head(0), _tail(0) { }
+	~ring_queue()
+	{
+		delete[] _items;
+	}
+
+	ring_queue(const ring_queue&) = delete;
+	ring_queue& operator=(const ring_queue&) = delete;
+
+	// capacity is rounded up to a power of two
+	void create(uint32_t capacity)
+	{
+		uint32_t rounded = 1;
+
+		while (rounded < capacity)
+		{
+			rounded <<= 1;
+		}
+
+		delete[] _items;
+		_items = new T[rounded];
+		_mask = rounded - 1;
+		_head = 0;
+		_tail = 0;
+	}
+	void clear()
+	{
+		_head = _tail;
+	}
+
+	bool empty() const { return _head == _tail; }
+	uint32_t size() const { return _tail - _head; }
+	uint32_t capacity() const { return _items == nullptr ? 0 : _mask + 1; }
+
+	void push_back(const T& item)
+	{
+		if (size() == capacity())
+		{
+			grow();
+		}
+
+		_items[_tail & _mask] = item;
+		++_tail;
+	}
+	void pop_front()
+	{
+		++_head;
+	}
+
+	T& front() { return _items[_head & _mask]; }
+	T& back() { return _items[(_tail - 1) & _mask]; }
+	const T& front() const { return _items[_head & _mask]; }
+	const T& back() const { return _items[(_tail - 1) & _mask]; }
+
+	uint32_t front_index() const { return _head; }
+	uint32_t back_index() const { return _tail - 1; }
+
+	// the element pushed with index, which has to still be queued
+	T& at_index(uint32_t index) { return _items[index & _mask]; }
+	bool is_queued(uint32_t index) const { return index - _head < _tail - _head; }
+
+private:
+	void grow()
+	{
+		uint32_t capacity = _items == nullptr ? 16 : (_mask + 1) * 2;
+		T* items = new T[capacity];
+
+		for (uint32_t i = _head; i != _tail; ++i)
+		{
+			items[i & (capacity - 1)] = _items[i & _mask];
+		}
+
+		delete[] _items;
+		_items = items;
+		_mask = capacity - 1;
+	}
+
+	T*			_items;
+	uint32_t	_mask;
+	uint32_t	_head;
+	uint32_t	_tail;
+};
+
+#endif
\ No newline at end of file
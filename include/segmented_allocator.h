@@ -0,0 +1,197 @@
+#ifndef onyx_segmented_allocator_h
+#define onyx_segmented_allocator_h
+
+#include <stdint.h>
+#include "buffer_pool.h"
+#include "ring_queue.h"
+
+/*
+ * a first in first out allocator that only holds the memory it is using
+ *
+ * allocations are laid out back to back in segments, a segment is a block taken from a buffer_pool
+ * that can be shared by many allocators. a new segment is chained on once an allocation doesn't fit
+ * the last one and handed back to the pool as soon as every allocation in it has been released.
+ * an allocation larger than a pool block gets a segment of its own from the heap.
+ *
+ * limit caps the bytes taken by allocations, not the memory held, so a quiet allocator holds nothing
+ * and a busy one only holds the segments its queued allocations are in.
+ */
+class segmented_allocator
+{
+public:
+	segmented_allocator() : _pool(nullptr), _limit(0), _allocated(0) { }
+	~segmented_allocator()
+	{
+		destroy();
+	}
+
+	segmented_allocator(const segmented_allocator&) = delete;
+	segmented_allocator& operator=(const segmented_allocator&) = delete;
+
+	void create(buffer_pool* pool, size_t limit)
+	{
+		destroy();
+
+		_pool = pool;
+		_limit = limit;
+	}
+	void destroy()
+	{
+		reset();
+
+		_pool = nullptr;
+		_limit = 0;
+	}
+
+	char* push_back(size_t size)
+	{
+		size = round_up(size + sizeof(size_t));
+
+		if (_allocated + size > _limit)
+		{
+			return nullptr;
+		}
+
+		if (_segments.empty() || (size_t)(_segments.back().end - _segments.back().alloc_end) < size)
+		{
+			_segments.push_back(new_segment(size));
+		}
+
+		segment& s = _segments.back();
+
+		*((size_t*)s.alloc_end) = size;
+
+		char* result = s.alloc_end + sizeof(size_t);
+		s.alloc_end += size;
+		_allocated += size;
+		return result;
+	}
+	// gives back the unused end of an allocation, only the most recent allocation can shrink, any
+	// other keeps its size
+
+	void shrink_back(char* ptr, size_t size)
+	{
+		char* allocation = ptr - sizeof(size_t);
+
+		size = round_up(size + sizeof(size_t));
+		size_t old_size = *((size_t*)allocation);
+
+		if (size >= old_size || allocation + old_size != _segments.back().alloc_end)
+		{
+			return;
+		}
+
+		*((size_t*)allocation) = size;
+
+		_segments.back().alloc_end = allocation + size;
+		_allocated -= old_size - size;
+	}
+	// marks an allocation as no longer needed, allocations can be released in any order but their
+	// memory only comes back once every allocation made before them has been released too
+
+	void release(char* ptr)
+	{
+		*((size_t*)(ptr - sizeof(size_t))) |= released_flag;
+
+		while (_allocated > 0 && (*((size_t*)_segments.front().alloc_begin) & released_flag) != 0)
+		{
+			pop_front();
+		}
+	}
+	void pop_front()
+	{
+		if (_allocated == 0)
+		{
+			return;
+		}
+
+		segment& s = _segments.front();
+
+		size_t allocation_size = *((size_t*)s.alloc_begin) & ~released_flag;
+
+		s.alloc_begin += allocation_size;
+		_allocated -= allocation_size;
+
+		// a drained segment goes straight back, the next allocation starts a fresh one
+
+		if (s.alloc_begin == s.alloc_end)
+		{
+			free_segment(s);
+			_segments.pop_front();
+		}
+	}
+
+	// the bytes taken by allocations, and the largest allocation an empty allocator can make
+	size_t size() const { return _allocated; }
+	size_t max_size() const { return _limit < sizeof(size_t) ? 0 : (_limit & ~(alignment - 1)) - sizeof(size_t); }
+
+	void reset()
+	{
+		while (!_segments.empty())
+		{
+			free_segment(_segments.front());
+			_segments.pop_front();
+		}
+
+		_allocated = 0;
+	}
+
+private:
+	// the top bit of an allocation's size marks it as released, no allocation gets near that large
+	static const size_t released_flag = ~(~((size_t)0) >> 1);
+
+	// allocations are rounded up to keep every size header aligned, a pool block that isn't a multiple
+	// of this starts its segment a few bytes in
+	static const size_t alignment = alignof(size_t);
+
+	static size_t round_up(size_t size) { return (size + alignment - 1) & ~(alignment - 1); }
+
+	struct segment
+	{
+		char*	begin;
+		char*	end;
+		char*	alloc_begin;
+		char*	alloc_end;
+		bool	pooled;
+	};
+
+	segment new_segment(size_t size)
+	{
+		segment s;
+		s.pooled = size + alignment - 1 <= _pool->block_size();
+
+		if (s.pooled)
+		{
+			s.begin = _pool->acquire();
+			s.end = s.begin + _pool->block_size();
+		}
+		else
+		{
+			s.begin = new char[size];
+			s.end = s.begin + size;
+		}
+
+		s.alloc_begin = s.begin + ((alignment - (uintptr_t)s.begin) & (alignment - 1));
+		s.alloc_end = s.alloc_begin;
+		return s;
+	}
+	void free_segment(const segment& s)
+	{
+		if (s.pooled)
+		{
+			_pool->release(s.begin);
+		}
+		else
+		{
+			delete[] s.begin;
+		}
+	}
+
+	buffer_pool*	_pool;
+	size_t			_limit;
+	size_t			_allocated;
+
+	ring_queue<segment>	_segments;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#ifndef onyx_slot_map_h
+#define onyx_slot_map_h
+
+#include <stdint.h>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+struct slot_handle
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+/*
+ * a pool of T's with stable addresses
+ *
+ * slots are carved out of fixed size chunks that are never moved or freed until the map is destroyed,
+ * so a pointer to an element stays valid until that element is erased. erasing a slot bumps its
+ * generation, which lets a stale slot_handle be told apart from the slot's next occupant.
+ *
+ * the occupied slots are also kept in a dense array for iteration, erasing swaps the last
+ * dense entry into the hole so both insertion and removal are O(1).
+ */
+template<class T, uint32_t chunk_size = 64>
+class slot_map
+{
+public:
+	static const uint32_t invalid_index = ~((uint32_t)0);
+
+	slot_map() : _free_head(invalid_index) { }
+	~slot_map()
+	{
+		clear();
+
+		for (size_t i = 0; i < _chunks.size(); ++i)
+		{
+			delete[] _chunks[i];
+		}
+	}
+
+	slot_map(const slot_map&) = delete;
+	slot_map& operator=(const slot_map&) = delete;
+
+	T* emplace(slot_handle* handle)
+	{
+		if (_free_head == invalid_index)
+		{
+			grow();
+		}
+
+		uint32_t index = _free_head;
+		slot& s = get_slot(index);
+
+		_free_head = s.link;
+
+		T* result = new (&s.storage) T();
+
+		s.occupied = true;
+		s.link = (uint32_t)_dense.size();
+		_dense.push_back(index);
+
+		handle->index = index;
+		handle->generation = s.generation;
+
+		return result;
+	}
+	void erase(uint32_t index)
+	{
+		slot& s = get_slot(index);
+
+		if (!s.occupied)
+		{
+			return;
+		}
+
+		get_value(s)->~T();
+
+		// move the last dense entry into the hole left by this slot
+
+		uint32_t dense_position = s.link;
+		uint32_t moved_index = _dense.back();
+
+		_dense[dense_position] = moved_index;
+		get_slot(moved_index).link = dense_position;
+		_dense.pop_back();
+
+		s.occupied = false;
+		++s.generation;
+		s.link = _free_head;
+		_free_head = index;
+	}
+	void clear()
+	{
+		while (!_dense.empty())
+		{
+			erase(_dense.back());
+		}
+	}
+
+	// returns nullptr if the handle refers to a slot that has since been erased
+
+	T* get(slot_handle handle)
+	{
+		if (handle.index >= _chunks.size() * chunk_size)
+		{
+			return nullptr;
+		}
+
+		slot& s = get_slot(handle.index);
+
+		if (!s.occupied || s.generation != handle.generation)
+		{
+			return nullptr;
+		}
+
+		return get_value(s);
+	}
+	T* at(uint32_t index)
+	{
+		slot& s = get_slot(index);
+
+		return s.occupied ? get_value(s) : nullptr;
+	}
+
+	// iteration over the occupied slots, the order changes whenever a slot is erased
+
+	size_t size() const { return _dense.size(); }
+	bool empty() const { return _dense.empty(); }
+
+	T& dense_at(size_t position) { return *get_value(get_slot(_dense[position])); }
+	uint32_t dense_index(size_t position) const { return _dense[position]; }
+
+private:
+	struct slot
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+		uint32_t	generation;
+
+		// the position in the dense array while occupied, the next free slot while free
+		uint32_t	link;
+
+		bool		occupied;
+	};
+
+	slot& get_slot(uint32_t index) { return _chunks[index / chunk_size][index % chunk_size]; }
+	const slot& get_slot(uint32_t index) const { return _chunks[index / chunk_size][index % chunk_size]; }
+
+	static T* get_value(slot& s) { return reinterpret_cast<T*>(&s.storage); }
+
+	void grow()
+	{
+		uint32_t base = (uint32_t)(_chunks.size() * chunk_size);
+
+		slot* chunk = new slot[chunk_size];
+
+		// thread the new slots onto the free list in order so low indices get used first
+
+		for (uint32_t i = 0; i < chunk_size; ++i)
+		{
+			chunk[i].generation = 0;
+			chunk[i].occupied = false;
+			chunk[i].link = (i + 1 < chunk_size) ? base + i + 1 : _free_head;
+		}
+
+		_chunks.push_back(chunk);
+		_free_head = base;
+	}
+
+	std::vector<slot*>		_chunks;
+	std::vector<uint32_t>	_dense;
+	uint32_t				_free_head;
+};
+
+#endif
\ No newline at end of file
@@ -2,7 +2,12 @@
 #define onyx_uuid_h
 
 #include <stdint.h>
+#include <cstring>
+#include <cwchar>
 #include <string>
+#include <algorithm>
+#include <iterator>
+#include <functional>
 
 namespace details
 {
@@ -99,6 +104,25 @@ static bool operator==(const uuid& a, const uuid& b)
 	return std::equal(a.cbegin(), a.cend(), b.cbegin());
 }
 
+namespace std
+{
+	template<>
+	struct hash<uuid>
+	{
+		size_t operator()(const uuid& id) const
+		{
+			// not every byte is random, a 32 bit generator leaves the top half of each 64 bit chunk zero,
+			// so both halves are multiplied to spread their bits and the high bits are folded back down
+
+			uint64_t halves[2];
+			memcpy(halves, id.data, sizeof(halves));
+
+			uint64_t hash = halves[0] * 0xFF51AFD7ED558CCDull ^ halves[1] * 0x9E3779B97F4A7C15ull;
+			return (size_t)(hash ^ (hash >> 32));
+		}
+	};
+}
+
 struct string_uuid_generator
 {
 	// Dispatch Functions
@@ -24,6 +24,7 @@ public:
 	virtual void on_peer_disconnected(const uuid& id) override
 	{
 		memset(&remote, 0, sizeof(remote));
+		remote_handle = connection_handle();
 		std::cout << "disconnected from [" << id.to_string() << "]" << std::endl;
 	}
 
@@ -50,10 +51,11 @@ public:
 
 		std::thread background([&]
 		{
+			// messages typed on this thread are picked up within max_wait of being sent
+
 			while (true)
 			{
-				ses.update();
-				std::this_thread::yield();
+				ses.wait_and_update(10000);
 			}
 		});
 
@@ -93,7 +95,10 @@ public:
 			{
 				if (!remote.is_nil() && input.length() > 0)
 				{
-					ses.send_reliable(input.c_str(), input.length() + 1, remote);
+					if (remote_handle.is_nil())
+						remote_handle = ses.find_handle(remote);
+
+					ses.send_reliable(input.c_str(), input.length() + 1, remote_handle);
 				}
 			}
 		}
@@ -103,6 +108,7 @@ public:
 
 private:
 	uuid remote;
+	connection_handle remote_handle;
 
 	void do_disconnect(network_session& ses)
 	{
@@ -111,6 +117,7 @@ private:
 			std::cout << "disconnecting from [" << remote.to_string() << "]" << std::endl;
 			ses.disconnect(remote);
 			memset(&remote, 0, sizeof(remote));
+			remote_handle = connection_handle();
 		}
 	}
 	void do_connect(network_session& ses)
@@ -157,11 +164,8 @@ private:
 
 int main(int argc, char** argv)
 {
-	WSAData wsa_data;
-
-	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	if (!network_startup())
 	{
-		printf("error initializing WSA\n");
 		return 1;
 	}
 
@@ -179,7 +183,7 @@ int main(int argc, char** argv)
 
 	printf("terminating..\n");
 
-	WSACleanup();
+	network_shutdown();
 
 	return 0;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 class chat_server : public network_session_handler
 {
 public:
+	chat_server() : session(nullptr) { }
+
 	virtual void on_message_received(bit_stream stream, const uuid& id) override
 	{
 		std::string broadcast = "[" + id.to_string() + "] " + stream.seek() + "\n";
@@ -13,12 +15,21 @@ public:
 
 	virtual void on_peer_joined(const uuid& id) override
 	{
-		remotes.push_back(id);
+		remotes.push_back(std::pair<uuid, connection_handle>(id, session->find_handle(id)));
 		std::cout << "[" << id.to_string().c_str() << "] joined" << std::endl;
 	}
 
 	virtual void on_peer_disconnected(const uuid& id) override
 	{
+		for (auto iter = remotes.begin(); iter != remotes.end(); ++iter)
+		{
+			if (iter->first == id)
+			{
+				remotes.erase(iter);
+				break;
+			}
+		}
+
 		std::cout << "[" << id.to_string().c_str() << "] disconnected" << std::endl;
 	}
 
@@ -32,6 +43,8 @@ public:
 
 	void loop(network_session& ses)
 	{
+		session = &ses;
+
 		std::cout << "local id = " << ses.local_id().to_string() << std::endl;
 
 		try
@@ -44,16 +57,15 @@ public:
 
 					for (auto iter = remotes.begin(); iter != remotes.end(); ++iter)
 					{
-						if (*iter == next_send.first)
+						if (iter->first == next_send.first)
 							continue;
-						ses.send_reliable(next_send.second.c_str(), next_send.second.length() + 1, *iter);
+						ses.send_reliable(next_send.second.c_str(), next_send.second.length() + 1, iter->second);
 					}
 
 					outgoing.pop();
 				}
 
-				ses.update();
-				std::this_thread::yield();
+				ses.wait_and_update(network_waiter::no_deadline);
 			}
 		}
 		catch (const std::system_error& e)
@@ -63,17 +75,16 @@ public:
 	}
 
 private:
-	std::vector<uuid>							remotes;
+	network_session*	session;
+
+	std::vector<std::pair<uuid, connection_handle>>	remotes;
 	std::queue<std::pair<uuid, std::string>>	outgoing;
 };
 
 int main(int argc, char** argv)
 {
-	WSAData wsa_data;
-
-	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	if (!network_startup())
 	{
-		printf("error initializing WSA\n");
 		return 1;
 	}
 
@@ -91,7 +102,7 @@ int main(int argc, char** argv)
 
 	printf("terminating..\n");
 
-	WSACleanup();
+	network_shutdown();
 
 	return 0;
 }
\ No newline at end of file
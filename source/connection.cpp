@@ -3,68 +3,92 @@
 network_session::connection::connection() :
 	_session(nullptr),
 	_last_ping_time(0),
+	_congestion(nullptr),
+	_mtu(network_session_config::base_transmission_unit),
+	_mtu_search_high(network_session_config::base_transmission_unit),
+	_probe_size(0),
+	_probe_failures(0),
+	_probe_outstanding(false),
+	_probe_ping_time(0),
+	_mtu_raise_deadline(0),
+	_split_sent(0),
+	_split_block(nullptr),
+	_split_id(0),
+	_split_length(0),
+	_split_remaining(0),
+	_stream_messengers(nullptr),
+	_stream_channel_count(0),
+	_send_ready(false),
 	_disconnected(false)
 {
 }
-network_session::connection::connection(const connection& rhs) :
-	_session(rhs._session),
-	_remote_address(rhs._remote_address),
-	_remote_uuid(rhs._remote_uuid),
-	_last_ping_time(rhs._last_ping_time),
-	_stream_messenger(rhs._stream_messenger),
-	_reliable_messenger(rhs._reliable_messenger),
-	_disconnected(rhs._disconnected)
+network_session::connection::~connection()
 {
-	_stream_messenger.set_connection(this);
-	_reliable_messenger.set_connection(this);
-}
-network_session::connection::connection(connection&& rhs) :
-	_session(rhs._session),
-	_remote_address(rhs._remote_address),
-	_remote_uuid(rhs._remote_uuid),
-	_last_ping_time(rhs._last_ping_time),
-	_stream_messenger(std::move(rhs._stream_messenger)),
-	_reliable_messenger(std::move(rhs._reliable_messenger)),
-	_disconnected(rhs._disconnected)
-{
-	_stream_messenger.set_connection(this);
-	_reliable_messenger.set_connection(this);
-}
-const network_session::connection& network_session::connection::operator=(connection rhs)
-{
-	swap(*this, rhs);
-	return *this;
-}
-
-void network_session::connection::swap(connection& a, connection& b)
-{
-	std::swap(a._session, b._session);
-	std::swap(a._remote_address, b._remote_address);
-	std::swap(a._remote_uuid, b._remote_uuid);
-	std::swap(a._last_ping_time, b._last_ping_time);
-	std::swap(a._stream_messenger, b._stream_messenger);
-	std::swap(a._reliable_messenger, b._reliable_messenger);
-	std::swap(a._disconnected, b._disconnected);
-
-	a._stream_messenger.set_connection(&a);
-	b._stream_messenger.set_connection(&b);
+	if (_split_block != nullptr)
+	{
+		_session->release_buffer(_split_block);
+	}
 
-	a._reliable_messenger.set_connection(&a);
-	b._reliable_messenger.set_connection(&b);
+	delete _congestion;
+	delete[] _stream_messengers;
 }
 
-void network_session::connection::create(network_session* session, const ip_address& remote_address, const uuid& remote_uuid, size_t stream_packet_queue_buffer_size, size_t reliable_packet_queue_buffer_size)
+void network_session::connection::create(network_session* session, const slot_handle& slot, const ip_address& remote_address, const uuid& remote_uuid, uint32_t sequence_bits, uint32_t window_size, uint32_t stream_channels)
 {
 	_session = session;
+	_slot = slot;
 
 	_remote_address = remote_address;
 	_remote_uuid = remote_uuid;
 
 	_last_ping_time = session->_timer.get_microseconds();
+	_rtt.reset();
 
-	_stream_messenger.create(session, this, stream_packet_queue_buffer_size);
-	_reliable_messenger.create(session, this, reliable_packet_queue_buffer_size);
+	delete _congestion;
+	_congestion = session->_config.create_congestion_controller();
+	_congestion->reset(_last_ping_time);
+	_pacer.reset();
 
+	// without discovery the configured mtu is trusted as is
+
+	const network_session_config& config = session->_config;
+
+	_mtu = config.discover_mtu ? network_session_config::base_transmission_unit : config.max_transmission_unit;
+	_mtu_search_high = config.max_transmission_unit;
+	_probe_failures = 0;
+	_probe_outstanding = false;
+	_probe_ping_time = 0;
+	_probe_size = config.discover_mtu ? next_probe_size(_last_ping_time) : 0;
+
+	if (_split_block != nullptr)
+	{
+		session->release_buffer(_split_block);
+		_split_block = nullptr;
+	}
+
+	_split_sent = 0;
+	_split_parts.clear();
+
+	// the first message sent on a sequenced channel is numbered 0, which is newer than 0xFFFF
+
+	for (uint32_t i = 0; i < network_session::sequenced_channels; ++i)
+	{
+		_sequenced_sent[i] = 0;
+		_sequenced_received[i] = 0xFFFF;
+	}
+
+	delete[] _stream_messengers;
+	_stream_messengers = new stream_messenger[stream_channels];
+	_stream_channel_count = stream_channels;
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].create(session, this, session->_config.stream_packet_queue_buffer_size, sequence_bits, window_size, (uint8_t)i);
+	}
+
+	_reliable_messenger.create(session, this, session->_config.reliable_packet_queue_buffer_size, sequence_bits, window_size);
+
+	_send_ready = false;
 	_disconnected = false;
 }
 
@@ -78,7 +102,7 @@ void network_session::connection::receive_message(packet* msg, uint64_t current_
 	}
 	uint8_t message_header = stream.fast_read<uint8_t>();
 
-	switch (message_header)
+	switch (message_header & message_type::type_mask)
 	{
 	case message_type::disconnecting:
 	{
@@ -88,45 +112,112 @@ void network_session::connection::receive_message(packet* msg, uint64_t current_
 
 	case message_type::ping:
 	{
-		if (stream.size() == 5)
+		if (stream.size() < 1 + 8)
+		{
+			break;
+		}
+
+		uint64_t ping_time = stream.fast_read<uint64_t>();
+
+		if (read_status(stream, current_time))
 		{
-			char ping_response[5];
-			stream.attach(ping_response, 5);
+			// a probe is only confirmed if it arrived whole
+
+			uint32_t probe_size = 0;
+
+			if (stream.size() >= stream.tell() + 2)
+			{
+				probe_size = stream.fast_read<uint16_t>();
+			}
+
+			char ping_response[connection::max_ping_size];
+			stream.attach(ping_response, sizeof(ping_response));
 
 			stream.fast_write<uint8_t>(message_type::ping_response);
-			stream.fast_write<uint8_t>(_stream_messenger.local_low_n_received());
-			stream.fast_write<uint8_t>(_reliable_messenger.local_low_n_received());
-			stream.fast_write<uint16_t>(_reliable_messenger.local_messages_received());
+			stream.fast_write<uint64_t>(ping_time);
+			write_status(stream);
 
-			_session->_socket.send(ping_response, 5, _remote_address);
+			if (probe_size != 0 && probe_size == msg->buffer_length)
+			{
+				stream.fast_write<uint16_t>((uint16_t)probe_size);
+			}
+
+			_session->_socket.queue_send(ping_response, stream.tell(), _remote_address);
 		}
 	}
 	break;
 	case message_type::ping_response:
 	{
-		if (stream.size() == 5)
+		if (stream.size() < 1 + 8)
 		{
-			_stream_messenger.receive_ack(stream.fast_read<uint8_t>(), current_time);
+			break;
+		}
 
-			uint8_t reliable_remote_lnr = stream.fast_read<uint8_t>();
-			uint16_t reliable_remote_ms = stream.fast_read<uint16_t>();
+		// the remote echoes our own clock back, so the sample is unaffected by resends
 
-			_reliable_messenger.receive_ack(reliable_remote_lnr, reliable_remote_ms, current_time);
+		uint64_t ping_time = stream.fast_read<uint64_t>();
+
+		if (ping_time <= current_time && current_time - ping_time < network_session::timeout_time)
+		{
+			_rtt.add_sample(current_time - ping_time);
+		}
+
+		if (read_status(stream, current_time) && stream.size() >= stream.tell() + 2)
+		{
+			uint32_t probe_size = stream.fast_read<uint16_t>();
+
+			if (_probe_outstanding && ping_time == _probe_ping_time && probe_size == _probe_size)
+			{
+				on_probe_acknowledged(current_time);
+			}
 		}
 	}
 	break;
 
 	case message_type::stream:
 	{
-		_stream_messenger.receive_message(stream, current_time);
+		if (stream.size() < 2)
+		{
+			break;
+		}
+
+		uint8_t channel = stream.fast_read<uint8_t>();
+
+		if (channel < _stream_channel_count)
+		{
+			_stream_messengers[channel].receive_message(stream, current_time);
+		}
+	}
+	break;
+
+	case message_type::stream_parity:
+	{
+		if (stream.size() < 2)
+		{
+			break;
+		}
+
+		uint8_t channel = stream.fast_read<uint8_t>();
+
+		if (channel < _stream_channel_count)
+		{
+			_stream_messengers[channel].receive_parity(stream, current_time);
+		}
 	}
 	break;
 
 	case message_type::stream_ack:
 	{
-		if (stream.size() == 2)
+		if (stream.size() < 2)
 		{
-			_stream_messenger.receive_ack(stream.fast_read<uint8_t>(), current_time);
+			break;
+		}
+
+		uint8_t channel = stream.fast_read<uint8_t>();
+
+		if (channel < _stream_channel_count)
+		{
+			_stream_messengers[channel].read_ack(stream, current_time, true);
 		}
 	}
 	break;
@@ -139,82 +230,523 @@ void network_session::connection::receive_message(packet* msg, uint64_t current_
 
 	case message_type::reliable_ack:
 	{
-		if (stream.size() == 4)
+		_reliable_messenger.read_ack(stream, current_time, true);
+	}
+	break;
+
+	case message_type::split:
+	{
+		receive_split(stream, current_time);
+	}
+	break;
+
+	case message_type::sequenced:
+	{
+		if (stream.size() < 4)
 		{
-			uint8_t _remote_low_n_received = stream.fast_read<uint8_t>();
-			uint16_t _remote_messages_received = stream.fast_read<uint16_t>();
+			break;
+		}
+
+		uint8_t channel = stream.fast_read<uint8_t>();
+		uint16_t sequence = stream.fast_read<uint16_t>();
 
-			_reliable_messenger.receive_ack(
-				_remote_low_n_received,
-				_remote_messages_received,
-				current_time
-				);
+		// anything that isn't newer than the last message delivered on its channel is dropped
+
+		if (channel >= network_session::sequenced_channels || (int16_t)(uint16_t)(sequence - _sequenced_received[channel]) <= 0)
+		{
+			break;
 		}
+
+		_sequenced_received[channel] = sequence;
+
+		_session->deliver_message(this, stream.seek(), stream.size() - stream.tell());
 	}
 	break;
 
 	case message_type::unreliable:
 	{
-		_session->_handler->on_message_received(
-			bit_stream(stream.seek(), stream.size() - stream.tell()),
-			_remote_uuid
-			);
+		_session->deliver_message(this, stream.seek(), stream.size() - stream.tell());
 	}
 	break;
 	}
 
 }
 
-void network_session::connection::send_unreliable(const char* buffer, const uint32_t length)
+send_result network_session::connection::send_unreliable(const char* buffer, const uint32_t length)
+{
+	if (length > _mtu)
+		return send_result_invalid;
+
+	return _session->_socket.queue_send(buffer, length, _remote_address) ? send_result_accepted : send_result_would_block;
+}
+send_result network_session::connection::send_stream(const char* buffer, const uint32_t length, uint32_t channel, message_priority priority, uint64_t lifetime)
+{
+	if (channel >= _stream_channel_count || priority >= network_session::priority_levels)
+		return send_result_invalid;
+
+	return _stream_messengers[channel].send(buffer, length, priority, lifetime);
+}
+send_result network_session::connection::send_reliable(const char* buffer, const uint32_t length, message_priority priority, uint64_t lifetime)
+{
+	if (priority >= network_session::priority_levels)
+		return send_result_invalid;
+
+	return _reliable_messenger.send(buffer, length, priority, lifetime);
+}
+send_result network_session::connection::send_sequenced(const char* buffer, const uint32_t length, uint32_t channel)
+{
+	if (channel >= network_session::sequenced_channels || length + 4 > _mtu)
+		return send_result_invalid;
+
+	bit_stream stream(_session->_send_buffer, length + 4);
+	stream.fast_write<uint8_t>(message_type::sequenced);
+	stream.fast_write<uint8_t>((uint8_t)channel);
+	stream.fast_write<uint16_t>(_sequenced_sent[channel]++);
+	memcpy(stream.seek(), buffer, length);
+
+	return _session->_socket.queue_send(stream.begin(), length + 4, _remote_address) ? send_result_accepted : send_result_would_block;
+}
+send_result network_session::connection::send_reliable_latest(const char* buffer, const uint32_t length, uint32_t key, message_priority priority)
+{
+	if (priority >= network_session::priority_levels)
+		return send_result_invalid;
+
+	return _reliable_messenger.send_latest(buffer, length, key, priority);
+}
+send_result network_session::connection::reserve_stream(bit_stream* stream, const uint32_t length, uint32_t channel, message_priority priority, uint64_t lifetime)
+{
+	if (channel >= _stream_channel_count || priority >= network_session::priority_levels)
+		return send_result_invalid;
+
+	return _stream_messengers[channel].reserve(stream, length, priority, lifetime);
+}
+send_result network_session::connection::reserve_reliable(bit_stream* stream, const uint32_t length, message_priority priority, uint64_t lifetime)
 {
-	_session->_socket.send(buffer, length, _remote_address);
+	if (priority >= network_session::priority_levels)
+		return send_result_invalid;
+
+	return _reliable_messenger.reserve(stream, length, priority, lifetime);
 }
-void network_session::connection::send_stream(const char* buffer, const uint32_t length)
+send_result network_session::connection::commit_stream(bit_stream& stream, uint32_t channel)
 {
-	_stream_messenger.send(buffer, length);
+	if (channel >= _stream_channel_count)
+		return send_result_invalid;
+
+	return _stream_messengers[channel].commit(stream.begin(), stream.tell());
 }
-void network_session::connection::send_reliable(const char* buffer, const uint32_t length)
+send_result network_session::connection::commit_reliable(bit_stream& stream)
 {
-	_reliable_messenger.send(buffer, length);
+	return _reliable_messenger.commit(stream.begin(), stream.tell());
 }
 
 void network_session::connection::update(uint64_t current_time)
 {
 	uint64_t time_since_last_ping = current_time - _last_ping_time;
-	uint64_t time_since_last_stream_ack = current_time - _stream_messenger.last_ack_time();
-	uint64_t time_since_last_reliable_ack = current_time - _reliable_messenger.last_ack_time();
+	uint64_t time_since_last_ack = current_time - last_ack_time();
 
 	// disconnect from the remote if we haven't gotten an acknowledgment in a while
 
-	if (time_since_last_stream_ack > network_session::timeout_time &&
-		time_since_last_reliable_ack > network_session::timeout_time)
+	if (time_since_last_ack >= network_session::timeout_time)
 	{
 		_disconnected = true;
 		return;
 	}
 
-	// update stream messaging
-
-	_stream_messenger.update(current_time);
-
-	// update reliable messaging
+	// resend anything that timed out on any channel
 
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].update(current_time);
+	}
 	_reliable_messenger.update(current_time);
 
+	send_queued(current_time);
+
 	// ping the remote if we haven't pinged them in a while
 
-	if (time_since_last_ping > network_session::ping_time)
+	if (time_since_last_ping >= network_session::ping_time)
+	{
+		// a probe still unanswered a whole ping_time later is taken as lost
+
+		if (_probe_outstanding)
+		{
+			on_probe_lost();
+		}
+
+		if (_probe_size == 0 && _session->_config.discover_mtu && current_time >= _mtu_raise_deadline)
+		{
+			_mtu_search_high = _session->_config.max_transmission_unit;
+			_probe_size = next_probe_size(current_time);
+		}
+
+		send_ping(current_time);
+	}
+}
+
+void network_session::connection::send_ping(uint64_t current_time)
+{
+	_last_ping_time = current_time;
+
+	char ping_message[connection::max_ping_size];
+	bit_stream stream(ping_message, sizeof(ping_message));
+
+	if (_probe_size != 0)
+	{
+		stream.attach(_session->_probe_buffer, _probe_size);
+	}
+
+	stream.fast_write<uint8_t>(message_type::ping);
+	stream.fast_write<uint64_t>(current_time);
+	write_status(stream);
+
+	// the padding of a probe is left as zeroes
+
+	if (_probe_size != 0)
+	{
+		stream.fast_write<uint16_t>((uint16_t)_probe_size);
+		stream.skip(_probe_size - stream.tell());
+
+		_probe_outstanding = true;
+		_probe_ping_time = current_time;
+	}
+
+	_session->_socket.queue_send(stream.begin(), stream.tell(), _remote_address);
+}
+void network_session::connection::on_probe_lost()
+{
+	_probe_outstanding = false;
+
+	if (++_probe_failures < connection::max_mtu_probes)
 	{
-		_last_ping_time = current_time;
+		return;
+	}
+
+	_probe_failures = 0;
+	_mtu_search_high = _probe_size - 1;
+	_probe_size = next_probe_size(_last_ping_time);
+}
+void network_session::connection::on_probe_acknowledged(uint64_t current_time)
+{
+	_probe_outstanding = false;
+	_probe_failures = 0;
+
+	// packets being coalesced into were sized for the old mtu, they are closed before it grows
+
+	_mtu = _probe_size;
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].flush();
+	}
+	_reliable_messenger.flush();
 
-		char ping_message[5];
-		bit_stream stream(ping_message, 5);
+	// the next size is probed right away, there is no reason to wait while the path keeps up
 
-		stream.fast_write<uint8_t>(message_type::ping);
-		stream.fast_write<uint8_t>(_stream_messenger.local_low_n_received());
-		stream.fast_write<uint8_t>(_reliable_messenger.local_low_n_received());
-		stream.fast_write<uint16_t>(_reliable_messenger.local_messages_received());
+	_probe_size = next_probe_size(current_time);
 
-		_session->_socket.send(ping_message, 5, _remote_address);
+	if (_probe_size != 0)
+	{
+		send_ping(current_time);
+	}
+}
+void network_session::connection::on_black_hole(uint64_t current_time)
+{
+	// without discovery the configured mtu is kept, there would be no search to find it again
+
+	if (!_session->_config.discover_mtu || _mtu <= network_session_config::base_transmission_unit)
+	{
+		return;
+	}
+
+	// the packets already built for the old mtu go out in parts, the ones being coalesced into are
+	// closed so nothing more is added to them
+
+	_mtu = network_session_config::base_transmission_unit;
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].flush();
+	}
+	_reliable_messenger.flush();
+
+	// the search starts over with the next ping, from the configured maximum down
+
+	_probe_size = 0;
+	_probe_failures = 0;
+	_probe_outstanding = false;
+	_mtu_raise_deadline = current_time;
+}
+uint32_t network_session::connection::next_probe_size(uint64_t current_time)
+{
+	if (_mtu_search_high < _mtu + connection::mtu_search_step)
+	{
+		_mtu_raise_deadline = current_time + network_session::mtu_raise_time;
+		return 0;
+	}
+
+	// the configured maximum is tried first, most paths either carry it or are much smaller
+
+	if (_mtu_search_high == _session->_config.max_transmission_unit)
+	{
+		return _mtu_search_high;
+	}
+
+	return (_mtu + _mtu_search_high + 1) / 2;
+}
+
+void network_session::connection::send_packet(const char* buffer, size_t length)
+{
+	if (length <= _mtu)
+	{
+		_session->_socket.queue_send(buffer, (uint32_t)length, _remote_address);
+		return;
+	}
+
+	uint32_t part_space = _mtu - connection::split_header_size;
+	uint32_t part_count = (uint32_t)((length + part_space - 1) / part_space);
+	uint32_t part_size = message_fragment::fragment_size((uint32_t)length, part_count);
+
+	++_split_sent;
+
+	for (uint32_t i = 0; i < part_count; ++i)
+	{
+		uint32_t offset = i * part_size;
+		uint32_t size = i + 1 < part_count ? part_size : (uint32_t)length - offset;
+
+		bit_stream stream(_session->_send_buffer, connection::split_header_size + size);
+		stream.fast_write<uint8_t>(message_type::split);
+		stream.fast_write<uint16_t>(_split_sent);
+		message_fragment::write_header(stream, i, part_count, (uint32_t)length);
+		memcpy(stream.seek(), buffer + offset, size);
+
+		_session->_socket.queue_send(stream.begin(), connection::split_header_size + size, _remote_address);
+	}
+}
+void network_session::connection::receive_split(bit_stream& stream, uint64_t current_time)
+{
+	if (stream.size() < connection::split_header_size)
+	{
+		return;
+	}
+
+	uint16_t split_id = stream.fast_read<uint16_t>();
+
+	message_fragment part;
+
+	if (!part.read(stream.seek(), stream.size() - stream.tell()) || part.message_length > _session->_receive_pool.block_size())
+	{
+		return;
+	}
+
+	// a part of a newer packet gives up the one being put together, a part of an older one is dropped
+
+	if (_split_block == nullptr || split_id != _split_id || part.message_length != _split_length || part.count != _split_parts.size())
+	{
+		if (_split_block != nullptr && (int16_t)(uint16_t)(split_id - _split_id) < 0)
+		{
+			return;
+		}
+
+		if (_split_block == nullptr)
+		{
+			_split_block = _session->_receive_pool.acquire();
+		}
+
+		_split_id = split_id;
+		_split_length = part.message_length;
+		_split_remaining = part.count;
+		_split_parts.assign(part.count, 0);
+	}
+
+	if (_split_parts[part.index])
+	{
+		return;
+	}
+
+	_split_parts[part.index] = 1;
+	memcpy(_split_block + part.offset(), part.data, part.length);
+
+	if (--_split_remaining > 0)
+	{
+		return;
+	}
+
+	// the whole packet is taken in like a datagram received into the block, which is released once
+	// nothing retains it. a packet can't be split twice
+
+	packet whole;
+	whole.buffer = _split_block;
+	whole.buffer_length = _split_length;
+
+	_split_block = nullptr;
+
+	if ((*whole.buffer & message_type::type_mask) != message_type::split)
+	{
+		receive_message(&whole, current_time);
+	}
+
+	_session->release_buffer(whole.buffer);
+}
+
+void network_session::connection::flush(uint64_t current_time)
+{
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].flush();
+	}
+	_reliable_messenger.flush();
+
+	send_queued(current_time);
+}
+uint32_t network_session::connection::packets_in_flight() const
+{
+	uint32_t in_flight = _reliable_messenger.in_flight();
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		in_flight += _stream_messengers[i].in_flight();
+	}
+
+	return in_flight;
+}
+uint64_t network_session::connection::last_ack_time() const
+{
+	uint64_t result = _reliable_messenger.last_ack_time();
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		result = std::max(result, _stream_messengers[i].last_ack_time());
+	}
+
+	return result;
+}
+void network_session::connection::send_queued(uint64_t current_time)
+{
+	// every queued message of a priority goes before any of a lower one, within a priority the channels
+	// take new messages in turn so none of them can starve the others of the congestion window
+
+	for (uint32_t priority = network_session::priority_levels; priority-- > 0;)
+	{
+		bool has_sent = true;
+
+		while (has_sent)
+		{
+			has_sent = false;
+
+			for (uint32_t i = 0; i < _stream_channel_count; ++i)
+			{
+				has_sent |= _stream_messengers[i].send_next(current_time, priority);
+			}
+			has_sent |= _reliable_messenger.send_next(current_time, priority);
+		}
+	}
+}
+
+void network_session::connection::write_status(bit_stream& stream)
+{
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		_stream_messengers[i].write_ack(stream);
+	}
+	_reliable_messenger.write_ack(stream);
+}
+bool network_session::connection::read_status(bit_stream& stream, uint64_t current_time)
+{
+	// ping has its own rtt sample, the acks it carries can be up to a ping_time old
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		if (!_stream_messengers[i].read_ack(stream, current_time, false))
+			return false;
+	}
+
+	return _reliable_messenger.read_ack(stream, current_time, false);
+}
+
+uint64_t network_session::connection::next_deadline(uint64_t current_time) const
+{
+	// the timeout fires once every messenger has gone without an acknowledgment for timeout_time
+
+	uint64_t deadline = last_ack_time() + network_session::timeout_time;
+
+	deadline = std::min(deadline, _last_ping_time + network_session::ping_time);
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		deadline = std::min(deadline, _stream_messengers[i].next_deadline(current_time));
+	}
+	deadline = std::min(deadline, _reliable_messenger.next_deadline(current_time));
+
+	return deadline;
+}
+
+void network_session::connection::on_packets_acknowledged(uint32_t acknowledged, uint64_t newest_send_time, uint64_t rtt_sample, uint64_t current_time)
+{
+	if (rtt_sample > 0)
+	{
+		_rtt.add_sample(rtt_sample);
+	}
+
+	congestion_ack ack;
+	ack.acknowledged = acknowledged;
+	ack.in_flight = packets_in_flight();
+	ack.newest_send_time = newest_send_time;
+	ack.rtt_sample = rtt_sample;
+	ack.smoothed_rtt = _rtt.smoothed_rtt();
+
+	_congestion->on_ack(ack, current_time);
+}
+
+uint64_t network_session::connection::pacing_interval() const
+{
+	// nothing is paced until the first round trip has been measured
+
+	if (!_session->_config.pace_sends || !_rtt.has_sample())
+	{
+		return 0;
+	}
+
+	return _congestion->pacing_interval(_rtt.smoothed_rtt());
+}
+
+void network_session::connection::get_stats(connection_stats* stats) const
+{
+	stats->smoothed_rtt = _rtt.smoothed_rtt();
+	stats->rtt_variance = _rtt.rtt_variance();
+	stats->latest_rtt = _rtt.latest_rtt();
+
+	stats->retransmission_timeout = _rtt.retransmission_timeout();
+
+	stats->congestion_window = _congestion->congestion_window();
+	stats->packets_in_flight = packets_in_flight();
+
+	stats->path_mtu = _mtu;
+
+	stats->queued_messages = _reliable_messenger.queued_messages();
+	stats->queued_bytes = _reliable_messenger.queued_bytes();
+
+	uint32_t messages_protected = 0;
+
+	stats->parity_packets_sent = 0;
+	stats->messages_recovered = 0;
+
+	for (uint32_t i = 0; i < _stream_channel_count; ++i)
+	{
+		stats->queued_messages += _stream_messengers[i].queued_messages();
+		stats->queued_bytes += _stream_messengers[i].queued_bytes();
+
+		messages_protected += _stream_messengers[i].messages_protected();
+		stats->parity_packets_sent += _stream_messengers[i].parity_packets_sent();
+		stats->messages_recovered += _stream_messengers[i].messages_recovered();
+	}
+
+	stats->fec_redundancy = messages_protected > 0 ? (float)stats->parity_packets_sent / messages_protected : 0.0f;
+}
+void network_session::connection::notify_send_ready()
+{
+	if (_send_ready)
+	{
+		_send_ready = false;
+		_session->_handler->on_send_ready(_remote_uuid, connection_handle(_slot));
 	}
 }
\ No newline at end of file
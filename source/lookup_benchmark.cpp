@@ -0,0 +1,156 @@
+#include "include/network_session.h"
+#include <iostream>
+
+// times network_session::find_connection by address and by uuid on a session holding more and more
+// connections, next to a linear scan over the same addresses like the session used to do
+
+class lookup_benchmark
+{
+public:
+	static const uint32_t lookups_per_run = 1000000;
+
+	bool create(network_session_handler* handler)
+	{
+		return session.create("40500", 0, 65536, handler, config);
+	}
+	void destroy()
+	{
+		clear();
+		session.destroy();
+	}
+
+	// the connections are only ever added to the session, nothing is sent to their random addresses
+	void run(uint32_t connection_count)
+	{
+		std::mt19937 mt(connection_count);
+
+		clear();
+
+		for (uint32_t i = 0; i < connection_count; ++i)
+		{
+			addresses.push_back(random_address(mt));
+			ids.push_back(random_uuid_generator<std::mt19937>()(mt));
+
+			session.add_connection(addresses.back(), ids.back(), config);
+		}
+
+		std::vector<uint32_t> order;
+		order.reserve(lookups_per_run);
+		for (uint32_t i = 0; i < lookups_per_run; ++i)
+		{
+			order.push_back(mt() % connection_count);
+		}
+
+		size_t found = 0;
+
+		uint64_t start = timer.get_nanoseconds();
+		for (uint32_t i = 0; i < lookups_per_run; ++i)
+		{
+			found += session.find_connection(addresses[order[i]])->slot().index;
+		}
+		uint64_t address_hash_time = timer.get_nanoseconds() - start;
+
+		start = timer.get_nanoseconds();
+		for (uint32_t i = 0; i < lookups_per_run; ++i)
+		{
+			found += session.find_connection(ids[order[i]])->slot().index;
+		}
+		uint64_t uuid_hash_time = timer.get_nanoseconds() - start;
+
+		// the linear scan gets a smaller run so the large connection counts finish in reasonable time
+
+		uint32_t linear_lookups = std::max<uint32_t>(1000, lookups_per_run / connection_count);
+
+		start = timer.get_nanoseconds();
+		for (uint32_t i = 0; i < linear_lookups; ++i)
+		{
+			found += std::find(addresses.begin(), addresses.end(), addresses[order[i]]) - addresses.begin();
+		}
+		uint64_t address_linear_time = timer.get_nanoseconds() - start;
+
+		printf(
+			"%8u connections: by address %6.1f ns, by uuid %6.1f ns, address linear scan %9.1f ns (%zu)\n",
+			connection_count,
+			(double)address_hash_time / lookups_per_run,
+			(double)uuid_hash_time / lookups_per_run,
+			(double)address_linear_time / linear_lookups,
+			found % 10
+			);
+	}
+
+	// removed by hand, destroying the session would send every connection a disconnect
+	void clear()
+	{
+		while (session._connections.size() > 0)
+		{
+			session.remove_connection(&session._connections.dense_at(session._connections.size() - 1));
+		}
+
+		addresses.clear();
+		ids.clear();
+	}
+
+private:
+	static ip_address random_address(std::mt19937& mt)
+	{
+		ip_address result;
+		memset(&result, 0, sizeof(result));
+
+#if defined(NETWORK_USE_IPV6)
+		result.wsa_ip_address.sin6_family = AF_INET6;
+		result.wsa_ip_address.sin6_port = (uint16_t)mt();
+
+		uint32_t words[4] = { (uint32_t)mt(), (uint32_t)mt(), (uint32_t)mt(), (uint32_t)mt() };
+		memcpy(&result.wsa_ip_address.sin6_addr, words, sizeof(words));
+#else
+		result.wsa_ip_address.sin_family = AF_INET;
+		result.wsa_ip_address.sin_port = (uint16_t)mt();
+		result.wsa_ip_address.sin_addr.s_addr = mt();
+#endif
+
+		return result;
+	}
+
+	network_session_config		config;
+	network_session				session;
+	network_timer				timer;
+
+	std::vector<ip_address>		addresses;
+	std::vector<uuid>			ids;
+};
+
+class null_handler : public network_session_handler
+{
+public:
+	virtual void on_message_received(bit_stream, const uuid&) override { }
+	virtual void on_peer_joined(const uuid&) override { }
+	virtual void on_peer_disconnected(const uuid&) override { }
+	virtual void query_result_handler(const ip_address&, bool, bool, uint32_t, uint32_t) override { }
+	virtual void connect_result_handler(const uuid&, bool, uint32_t) override { }
+};
+
+int main(int argc, char** argv)
+{
+	if (!network_startup())
+	{
+		return 1;
+	}
+
+	null_handler handler;
+	lookup_benchmark benchmark;
+
+	if (!benchmark.create(&handler))
+	{
+		return 1;
+	}
+
+	for (uint32_t connection_count = 16; connection_count <= 65536; connection_count *= 4)
+	{
+		benchmark.run(connection_count);
+	}
+
+	benchmark.destroy();
+
+	network_shutdown();
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,849 @@
+#include "include/network_session.h"
+
+network_session::connection::messenger::messenger() :
+	_session(nullptr),
+	_connection(nullptr),
+	_type(0),
+	_ack_type(0),
+	_type_size(0),
+	_channel(0),
+	_packet_reserve(0),
+	_window_size(0),
+	_local_low_n_sent(0),
+	_local_low_n_received(0),
+	_local_high_n_distance(0),
+	_remote_low_n_received(0),
+	_last_ack_time(0),
+	_last_resend_time(0),
+	_resend_backoff(0),
+	_tail_probe_sent(false),
+	_ack_pending(false),
+	_ack_deadline(0),
+	_received_since_ack(0),
+	_coalescing(false),
+	_coalesce_priority(0),
+	_coalesce_deadline(0),
+	_queued_messages(0),
+	_send_blocked(false),
+	_reserved_priority(0) { }
+
+void network_session::connection::messenger::create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size, uint8_t type, uint8_t ack_type, uint32_t type_size, uint8_t channel)
+{
+	_session = session;
+	_connection = connection;
+
+	_type = type;
+	_ack_type = ack_type;
+	_type_size = type_size;
+	_channel = channel;
+	_packet_reserve = 0;
+
+	_sequence.create(sequence_bits);
+	_window_size = window_size;
+
+	_local_low_n_sent = 0;
+	_local_low_n_received = 0;
+	_local_high_n_distance = 0;
+
+	_remote_low_n_received = 0;
+
+	uint64_t current_time = session->_timer.get_microseconds();
+	_last_ack_time = current_time;
+	_last_resend_time = current_time;
+	_resend_backoff = 0;
+	_tail_probe_sent = false;
+
+	_ack_pending = false;
+	_ack_deadline = 0;
+	_received_since_ack = 0;
+
+	_coalescing = false;
+	_coalesce_priority = 0;
+	_coalesce_deadline = 0;
+
+	_allocator.create(&session->_packet_queue_pool, packet_queue_buffer_size);
+	_queued_messages = 0;
+	_send_blocked = false;
+
+	_reserved = packet();
+	_reserved_priority = 0;
+	_assembler.create(session->_config.max_message_size, session->_config.reassembly_buffer_size);
+
+	_window.assign(_window_size, packet());
+	_received.assign(_window_size, 0);
+
+	for (uint32_t i = 0; i < network_session::priority_levels; ++i)
+	{
+		_queues[i].clear();
+	}
+}
+
+void network_session::connection::messenger::receive_ack(uint32_t new_rnd, uint64_t current_time, bool sample_rtt)
+{
+	// ensure the new_rnd has either remained the same or acknowledged some packets
+
+	uint32_t dist_old_rnd = _sequence.distance(_local_low_n_sent, _remote_low_n_received);
+	uint32_t dist_new_rnd = _sequence.distance(_local_low_n_sent, new_rnd);
+
+	if (dist_new_rnd <= dist_old_rnd)
+	{
+		_last_ack_time = current_time;
+
+		uint32_t acknowledged = dist_old_rnd - dist_new_rnd;
+
+		// by karn's rule only a packet that was never resent gives an unambiguous rtt sample
+
+		uint32_t newly_acknowledged = 0;
+		const packet* newest = nullptr;
+		const packet* newest_sample = nullptr;
+
+		for (uint32_t i = 0; i < acknowledged; ++i)
+		{
+			const packet& p = _window[_sequence.add(_remote_low_n_received, i) & (_window_size - 1)];
+
+			if (p.acknowledged)
+			{
+				continue;
+			}
+
+			++newly_acknowledged;
+			newest = &p;
+
+			if (!p.resent)
+			{
+				newest_sample = &p;
+			}
+		}
+
+		if (newest != nullptr)
+		{
+			_connection->on_packets_acknowledged(
+				newly_acknowledged,
+				newest->send_time,
+				newest_sample != nullptr && sample_rtt ? current_time - newest_sample->send_time : 0,
+				current_time
+				);
+		}
+
+		if (acknowledged > 0)
+		{
+			_resend_backoff = 0;
+			_tail_probe_sent = false;
+		}
+
+		// priorities and expiry send packets out of allocation order, the allocator takes them back in order once released
+
+		for (uint32_t i = 0; i < acknowledged; ++i)
+		{
+			uint32_t message_index = _sequence.add(_remote_low_n_received, i) & (_window_size - 1);
+
+			if (_window[message_index].allocation != nullptr)
+			{
+				release(_window[message_index].allocation);
+			}
+
+			_window[message_index] = packet();
+		}
+
+		_remote_low_n_received = new_rnd;
+	}
+}
+
+void network_session::connection::messenger::deliver(uint32_t message_id, char* packet, size_t packet_length)
+{
+	uint8_t flags = *packet;
+
+	char* buffer = packet + header_size();
+	size_t length = packet_length - header_size();
+
+	if (flags & message_type::fragment)
+	{
+		message_fragment fragment;
+		fragment.read(buffer, length);
+
+		uint32_t first_id = _sequence.distance(message_id, fragment.index);
+		std::vector<char>* message = _assembler.add(first_id, fragment);
+
+		if (message != nullptr)
+		{
+			_session->deliver_message(_connection, message->data(), message->size());
+
+			_assembler.release(first_id);
+		}
+		return;
+	}
+
+	if ((flags & message_type::coalesced) == 0)
+	{
+		_session->deliver_message(_connection, buffer, length);
+		return;
+	}
+
+	// unpack the [2] length [x] data frames, a frame running past the end of the packet is dropped
+
+	bit_stream frames(buffer, length);
+
+	while (frames.tell() + 2 <= length)
+	{
+		uint32_t frame_length = frames.fast_read<uint16_t>();
+
+		if (frames.tell() + frame_length > length)
+			break;
+
+		_session->deliver_message(_connection, frames.seek(), frame_length);
+
+		frames.skip(frame_length);
+	}
+}
+
+void network_session::connection::messenger::schedule_ack(bool immediately, uint64_t current_time)
+{
+	++_received_since_ack;
+
+	if (immediately || _received_since_ack >= connection::ack_frequency)
+	{
+		send_ack();
+	}
+	else if (!_ack_pending)
+	{
+		_ack_pending = true;
+		_ack_deadline = current_time + network_session::ack_delay_time;
+	}
+}
+void network_session::connection::messenger::send_ack()
+{
+	char ack_message[2 + connection::max_ack_size];
+	bit_stream ack(ack_message, sizeof(ack_message));
+	ack.fast_write<uint8_t>(_ack_type);
+
+	if (_type_size > 1)
+	{
+		ack.fast_write<uint8_t>(_channel);
+	}
+
+	write_ack(ack);
+
+	_session->_socket.queue_send(ack_message, ack.tell(), _connection->_remote_address);
+}
+void network_session::connection::messenger::piggyback_ack()
+{
+	// next_desired in a message header only acknowledges everything when there are no gaps
+
+	if (_local_high_n_distance == 0)
+	{
+		_ack_pending = false;
+		_received_since_ack = 0;
+	}
+}
+
+void network_session::connection::messenger::write_ack(bit_stream& stream)
+{
+	_ack_pending = false;
+	_received_since_ack = 0;
+
+	_sequence.write(stream, _local_low_n_received);
+
+	// the range count is filled in once the ranges are written
+
+	uint8_t* range_count = (uint8_t*)stream.seek();
+	stream.fast_write<uint8_t>(0);
+
+	uint32_t ranges = 0;
+	uint32_t distance = 1;
+
+	while (distance <= _local_high_n_distance && ranges < connection::max_ack_ranges)
+	{
+		if (!_received[_sequence.add(_local_low_n_received, distance) & (_window_size - 1)])
+		{
+			++distance;
+			continue;
+		}
+
+		uint32_t range_begin = distance;
+
+		while (distance <= _local_high_n_distance && _received[_sequence.add(_local_low_n_received, distance) & (_window_size - 1)])
+		{
+			++distance;
+		}
+
+		stream.fast_write<uint16_t>((uint16_t)range_begin);
+		stream.fast_write<uint16_t>((uint16_t)(distance - range_begin));
+		++ranges;
+	}
+
+	*range_count = (uint8_t)ranges;
+}
+bool network_session::connection::messenger::read_ack(bit_stream& stream, uint64_t current_time, bool sample_rtt)
+{
+	if (stream.size() < stream.tell() + _sequence.bytes() + 1)
+	{
+		return false;
+	}
+
+	uint32_t new_rnd = _sequence.read(stream);
+	uint32_t range_count = stream.fast_read<uint8_t>();
+
+	if (range_count > connection::max_ack_ranges || stream.size() < stream.tell() + range_count * 4)
+	{
+		return false;
+	}
+
+	receive_ack(new_rnd, current_time, sample_rtt);
+
+	// ranges are only trusted if the ack they came with was current
+
+	bool is_current = _remote_low_n_received == new_rnd;
+	uint32_t in_flight = _sequence.distance(_local_low_n_sent, _remote_low_n_received);
+
+	uint32_t newly_acknowledged = 0;
+	uint32_t highest_acknowledged = 0;
+	uint64_t newest_acknowledged_send_time = 0;
+	const packet* newest = nullptr;
+	const packet* newest_sample = nullptr;
+
+	for (uint32_t i = 0; i < range_count; ++i)
+	{
+		uint32_t range_begin = stream.fast_read<uint16_t>();
+		uint32_t range_end = range_begin + stream.fast_read<uint16_t>();
+
+		for (uint32_t distance = range_begin; is_current && distance < range_end && distance < in_flight; ++distance)
+		{
+			packet& p = _window[_sequence.add(new_rnd, distance) & (_window_size - 1)];
+
+			highest_acknowledged = std::max(highest_acknowledged, distance);
+			newest_acknowledged_send_time = std::max(newest_acknowledged_send_time, p.send_time);
+
+			if (p.acknowledged)
+			{
+				continue;
+			}
+
+			p.acknowledged = true;
+
+			++newly_acknowledged;
+			newest = &p;
+
+			if (!p.resent)
+			{
+				newest_sample = &p;
+			}
+		}
+	}
+
+	if (newest != nullptr)
+	{
+		_connection->on_packets_acknowledged(
+			newly_acknowledged,
+			newest->send_time,
+			newest_sample != nullptr && sample_rtt ? current_time - newest_sample->send_time : 0,
+			current_time
+			);
+
+		_tail_probe_sent = false;
+	}
+
+	// fast retransmit, a message is lost once loss_threshold messages past it have been acknowledged and
+	// one of them was sent after it, so a message that was just resent isn't declared lost again
+	// like after a timeout no more than the congestion window is resent at once, the holes left over are
+	// still behind the newest acknowledged send time and go out as later acks come in
+
+	uint32_t resent = 0;
+
+	for (
+		uint32_t distance = 0;
+		distance + connection::loss_threshold <= highest_acknowledged && resent < _connection->_congestion->congestion_window();
+		++distance
+		)
+	{
+		uint32_t seq = _sequence.add(new_rnd, distance);
+		const packet& p = _window[seq & (_window_size - 1)];
+
+		if (p.acknowledged || p.send_time >= newest_acknowledged_send_time)
+		{
+			continue;
+		}
+
+		_connection->_congestion->on_loss(p.send_time, current_time);
+		resend_message(seq, current_time);
+
+		++resent;
+	}
+
+	return true;
+}
+
+send_result network_session::connection::messenger::send(const char* buffer, const uint32_t length, uint32_t priority, uint64_t lifetime)
+{
+	uint64_t expiry_time = lifetime != 0 ? _session->_timer.get_microseconds() + lifetime : 0;
+
+	if (_session->_config.coalesce_messages && header_size() + 2 + length <= max_packet_size())
+	{
+		return coalesce(buffer, length, priority, expiry_time);
+	}
+
+	if (length + header_size() > max_packet_size())
+	{
+		return send_fragmented(buffer, length, priority, expiry_time);
+	}
+
+	// the packet being coalesced into has to stay the last allocation until it is closed
+
+	flush();
+
+	packet p;
+	p.buffer_length = length + header_size();
+	p.buffer = _allocator.push_back(p.buffer_length);
+
+	if (p.buffer == nullptr)
+		return allocation_failed(p.buffer_length);
+
+	p.allocation = p.buffer;
+	p.messages = 1;
+	p.expiry_time = expiry_time;
+
+	write_type(p.buffer, 0);
+	memcpy(p.buffer + header_size(), buffer, length);
+
+	_queues[priority].push_back(p);
+	++_queued_messages;
+	return send_result_accepted;
+}
+send_result network_session::connection::messenger::reserve(bit_stream* stream, const uint32_t length, uint32_t priority, uint64_t lifetime)
+{
+	if (length + header_size() > max_packet_size())
+		return send_result_invalid;
+
+	// reserving again gives the previous reservation up
+
+	if (_reserved.buffer != nullptr)
+	{
+		release(_reserved.allocation);
+		_reserved = packet();
+	}
+
+	flush();
+
+	packet p;
+	p.buffer_length = length + header_size();
+	p.buffer = _allocator.push_back(p.buffer_length);
+
+	if (p.buffer == nullptr)
+		return allocation_failed(p.buffer_length);
+
+	p.allocation = p.buffer;
+	p.messages = 1;
+	p.expiry_time = lifetime != 0 ? _session->_timer.get_microseconds() + lifetime : 0;
+
+	write_type(p.buffer, 0);
+	_reserved = p;
+	_reserved_priority = priority;
+
+	stream->attach(p.buffer + header_size(), length);
+	return send_result_accepted;
+}
+send_result network_session::connection::messenger::commit(char* data, size_t length)
+{
+	if (_reserved.buffer == nullptr || data != _reserved.buffer + header_size() || length + header_size() > _reserved.buffer_length)
+		return send_result_invalid;
+
+	// the end that wasn't written is given back if nothing was allocated after the reservation
+	// a packet being coalesced into has to stay at the back of its queue, so it is closed first
+
+	_reserved.buffer_length = length + header_size();
+	_allocator.shrink_back(_reserved.buffer, _reserved.buffer_length);
+
+	flush();
+
+	_queues[_reserved_priority].push_back(_reserved);
+	_reserved = packet();
+
+	++_queued_messages;
+	return send_result_accepted;
+}
+send_result network_session::connection::messenger::coalesce(const char* buffer, const uint32_t length, uint32_t priority, uint64_t expiry_time)
+{
+	if (header_size() + 2 + length > max_packet_size())
+		return send_result_invalid;
+
+	if (_coalescing && (_coalesce_priority != priority || _queues[priority].back().buffer_length + 2 + length > max_packet_size()))
+	{
+		flush();
+	}
+
+	// open a new packet sized for the mtu, it is the last allocation until it is flushed so it can shrink back afterwards
+
+	if (!_coalescing)
+	{
+		packet p;
+		p.buffer_length = header_size();
+		p.buffer = _allocator.push_back(max_packet_size());
+
+		if (p.buffer == nullptr)
+			return allocation_failed(max_packet_size());
+
+		p.allocation = p.buffer;
+		p.expiry_time = expiry_time;
+
+		write_type(p.buffer, message_type::coalesced);
+		_queues[priority].push_back(p);
+
+		_coalescing = true;
+		_coalesce_priority = priority;
+		_coalesce_deadline = _session->_timer.get_microseconds() + _session->_config.coalesce_time;
+	}
+
+	packet& p = _queues[priority].back();
+	++p.messages;
+
+	// the packet is kept for as long as any of its messages would be
+
+	if (p.expiry_time != 0)
+	{
+		p.expiry_time = expiry_time != 0 ? std::max(p.expiry_time, expiry_time) : 0;
+	}
+
+	bit_stream frame(p.buffer + p.buffer_length, 2 + length);
+	frame.fast_write<uint16_t>((uint16_t)length);
+	memcpy(frame.seek(), buffer, length);
+
+	p.buffer_length += 2 + length;
+	++_queued_messages;
+	return send_result_accepted;
+}
+send_result network_session::connection::messenger::send_fragmented(const char* buffer, const uint32_t length, uint32_t priority, uint64_t expiry_time)
+{
+	if (length > _session->_config.max_message_size)
+		return send_result_invalid;
+
+	// split into as few fragments as fit the mtu, all the same size except for a shorter last one
+
+	uint32_t packet_header_size = header_size() + message_fragment::header_size;
+	uint32_t fragment_space = max_packet_size() - packet_header_size;
+	uint32_t fragment_count = (length + fragment_space - 1) / fragment_space;
+	uint32_t fragment_size = message_fragment::fragment_size(length, fragment_count);
+
+	if (fragment_count > 0xFFFF)
+		return send_result_invalid;
+
+	// the fragments are laid out back to back in a single allocation, which the last one frees
+	// only the first one expires, once it is sent the rest of the message has to follow
+
+	flush();
+
+	char* allocation = _allocator.push_back(length + fragment_count * packet_header_size);
+
+	if (allocation == nullptr)
+		return allocation_failed(length + fragment_count * packet_header_size);
+
+	for (uint32_t i = 0; i < fragment_count; ++i)
+	{
+		uint32_t offset = i * fragment_size;
+		uint32_t size = i + 1 < fragment_count ? fragment_size : length - offset;
+
+		packet p;
+		p.buffer = allocation + offset + i * packet_header_size;
+		p.buffer_length = packet_header_size + size;
+		p.allocation = i + 1 == fragment_count ? allocation : nullptr;
+		p.messages = i + 1 == fragment_count ? 1 : 0;
+		p.expiry_time = i == 0 ? expiry_time : 0;
+
+		write_type(p.buffer, message_type::fragment);
+
+		bit_stream header(p.buffer + header_size(), message_fragment::header_size);
+		message_fragment::write_header(header, i, fragment_count, length);
+
+		memcpy(p.buffer + packet_header_size, buffer + offset, size);
+
+		_queues[priority].push_back(p);
+	}
+
+	++_queued_messages;
+	return send_result_accepted;
+}
+void network_session::connection::messenger::flush()
+{
+	if (_coalescing)
+	{
+		packet& p = _queues[_coalesce_priority].back();
+
+		_allocator.shrink_back(p.buffer, p.buffer_length);
+		_coalescing = false;
+	}
+}
+void network_session::connection::messenger::drop_expired(uint32_t priority, uint64_t current_time)
+{
+	ring_queue<packet>& queue = _queues[priority];
+
+	while (!queue.empty())
+	{
+		const packet& front = queue.front();
+
+		if (!front.superseded && (front.expiry_time == 0 || front.expiry_time > current_time))
+			break;
+
+		bool is_last = false;
+
+		while (!is_last)
+		{
+			packet& p = queue.front();
+
+			on_dropped(p);
+
+			if (_coalescing && _coalesce_priority == priority && queue.size() == 1)
+			{
+				_coalescing = false;
+			}
+
+			_queued_messages -= p.messages;
+			is_last = p.allocation != nullptr;
+
+			if (is_last)
+			{
+				release(p.allocation);
+			}
+
+			queue.pop_front();
+		}
+	}
+}
+size_t network_session::connection::messenger::queued_packets() const
+{
+	size_t queued = 0;
+
+	for (uint32_t i = 0; i < network_session::priority_levels; ++i)
+	{
+		queued += _queues[i].size();
+	}
+
+	return queued;
+}
+void network_session::connection::messenger::release(char* allocation)
+{
+	_allocator.release(allocation);
+
+	if (_send_blocked)
+	{
+		_send_blocked = false;
+		_connection->_send_ready = true;
+	}
+}
+send_result network_session::connection::messenger::allocation_failed(size_t size)
+{
+	if (size > _allocator.max_size())
+		return send_result_invalid;
+
+	_send_blocked = true;
+	return send_result_would_block;
+}
+
+bool network_session::connection::messenger::send_next(uint64_t current_time, uint32_t priority)
+{
+	drop_expired(priority, current_time);
+
+	ring_queue<packet>& queue = _queues[priority];
+
+	if (queue.empty() || in_flight() >= _window_size || !_connection->can_send(current_time))
+	{
+		return false;
+	}
+
+	// the packet messages are being coalesced into is held until it fills up or its deadline passes
+
+	if (_coalescing && _coalesce_priority == priority && queue.size() == 1)
+	{
+		if (current_time < _coalesce_deadline)
+		{
+			return false;
+		}
+
+		flush();
+	}
+
+	// reset the resend time on the connection because we are sending a message, which is also the new tail
+
+	_last_resend_time = current_time;
+	_tail_probe_sent = false;
+
+	// move the queued message to the window
+
+	uint32_t message_index = _local_low_n_sent & (_window_size - 1);
+
+	_window[message_index] = queue.front();
+	_window[message_index].send_time = current_time;
+	queue.pop_front();
+
+	_queued_messages -= _window[message_index].messages;
+
+	// the type was written when the message was queued, fill in the sequence numbers and send it
+
+	bit_stream stream(
+		_window[message_index].buffer,
+		_window[message_index].buffer_length
+		);
+
+	stream.skip(_type_size);
+	_sequence.write(stream, _local_low_n_sent);
+	_sequence.write(stream, _local_low_n_received);
+
+	piggyback_ack();
+
+	_connection->send_packet(_window[message_index].buffer, _window[message_index].buffer_length);
+
+	_connection->on_packet_sent(current_time);
+
+	on_sent(_local_low_n_sent, _window[message_index], current_time);
+
+	// advance the window forward, let it wrap around
+
+	_local_low_n_sent = _sequence.add(_local_low_n_sent, 1);
+
+	return true;
+}
+
+void network_session::connection::messenger::update(uint64_t current_time)
+{
+	// expired messages give their room in the packet queue buffer back even while the window is full
+
+	for (uint32_t i = 0; i < network_session::priority_levels; ++i)
+	{
+		drop_expired(i, current_time);
+	}
+
+	if (_ack_pending && current_time >= _ack_deadline)
+	{
+		send_ack();
+	}
+
+	uint64_t time_since_last_resend = current_time - _last_resend_time;
+	uint32_t in_flight = _sequence.distance(_local_low_n_sent, _remote_low_n_received);
+
+	// resend messages if we have unacknowledged messages and haven't sent a message in a while
+
+	if (
+		time_since_last_resend >= resend_timeout() &&
+		in_flight > 0
+		)
+	{
+		_last_resend_time = current_time;
+		_resend_backoff = std::min<uint32_t>(_resend_backoff + 1, 16);
+
+		const packet& oldest = _window[_remote_low_n_received & (_window_size - 1)];
+
+		_connection->_congestion->on_timeout(oldest.send_time, current_time);
+
+		// a packet only the old mtu fit that keeps timing out may be lost to a path that shrank, falling
+		// back before the resends below lets them go out in parts
+
+		if (_resend_backoff >= connection::black_hole_timeouts && oldest.buffer_length > network_session_config::base_transmission_unit)
+		{
+			_connection->on_black_hole(current_time);
+		}
+
+		// after a timeout only as much as the congestion window allows is resent, oldest first
+
+		uint32_t resend_count = std::min(in_flight, _connection->_congestion->congestion_window());
+
+		for (uint32_t i = 0; i < resend_count; ++i)
+		{
+			uint32_t seq = _sequence.add(_remote_low_n_received, i);
+
+			if (!_window[seq & (_window_size - 1)].acknowledged)
+			{
+				resend_message(seq, current_time);
+			}
+		}
+	}
+
+	// tail loss probe, the newest message is sent again if the last of a burst go unacknowledged for
+	// a couple of round trips, its ack shows what is missing and lets fast retransmit recover it
+	// without waiting for the resend timer, the timer firing above rules it out until the next ack
+
+	if (
+		in_flight > 0 &&
+		can_probe_tail() &&
+		time_since_last_resend >= tail_probe_timeout() &&
+		tail_probe_timeout() < resend_timeout()
+		)
+	{
+		_tail_probe_sent = true;
+
+		for (uint32_t i = in_flight; i > 0; --i)
+		{
+			uint32_t seq = _sequence.add(_remote_low_n_received, i - 1);
+
+			if (!_window[seq & (_window_size - 1)].acknowledged)
+			{
+				resend_message(seq, current_time);
+				break;
+			}
+		}
+	}
+}
+
+void network_session::connection::messenger::write_type(char* buffer, uint8_t flags) const
+{
+	buffer[0] = (char)(_type | flags);
+
+	if (_type_size > 1)
+	{
+		buffer[1] = (char)_channel;
+	}
+}
+void network_session::connection::messenger::resend_message(uint32_t seq, uint64_t current_time)
+{
+	uint32_t message_index = seq & (_window_size - 1);
+
+	// we need to update the next desired field of the header, it may have changed
+
+	bit_stream stream = _window[message_index].get_stream();
+	stream.skip(_type_size + _sequence.bytes());
+	_sequence.write(stream, _local_low_n_received);
+
+	// the send time moves to the resend so its ack counts towards the congestion window again,
+	// resent still keeps it out of the rtt samples
+
+	_window[message_index].send_time = current_time;
+	_window[message_index].resent = true;
+
+	piggyback_ack();
+
+	_connection->send_packet(_window[message_index].buffer, _window[message_index].buffer_length);
+
+	_connection->on_packet_sent(current_time);
+}
+
+uint64_t network_session::connection::messenger::next_deadline(uint64_t current_time) const
+{
+	uint32_t unacknowledged = _sequence.distance(_local_low_n_sent, _remote_low_n_received);
+
+	uint64_t deadline = _ack_pending ? _ack_deadline : network_waiter::no_deadline;
+
+	if (unacknowledged > 0)
+	{
+		deadline = std::min(deadline, _last_resend_time + resend_timeout());
+
+		if (can_probe_tail())
+		{
+			deadline = std::min(deadline, _last_resend_time + tail_probe_timeout());
+		}
+	}
+
+	// queued messages go out as soon as the window has room for them and the pacer lets them
+	// a packet still being coalesced into also waits for its deadline
+
+	size_t queued = queued_packets();
+
+	if (queued > 0 && unacknowledged < _window_size && !_connection->is_congestion_limited())
+	{
+		uint64_t send_time = std::max(current_time, _connection->_pacer.next_send_time());
+
+		if (_coalescing && queued == 1)
+		{
+			send_time = std::max(send_time, _coalesce_deadline);
+		}
+
+		deadline = std::min(deadline, send_time);
+	}
+
+	return deadline;
+}
\ No newline at end of file
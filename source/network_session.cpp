@@ -1,6 +1,6 @@
 #include "include/network_session.h"
 
-network_session::network_session() { }
+network_session::network_session() : _receive_time(0), _probe_buffer(nullptr), _send_buffer(nullptr) { }
 network_session::~network_session()
 {
 	destroy();
@@ -15,10 +15,30 @@ bool network_session::create(
 	size_t reliable_packet_queue_buffer_size,
 	bool drop_packets
 	)
+{
+	network_session_config config;
+	config.stream_packet_queue_buffer_size = stream_packet_queue_buffer_size;
+	config.reliable_packet_queue_buffer_size = reliable_packet_queue_buffer_size;
+	config.drop_packets = drop_packets;
+
+	return create(port_number, password, max_connections, handler, config);
+}
+bool network_session::create(
+	const char* port_number,
+	uint32_t password,
+	uint32_t max_connections,
+	network_session_handler* handler,
+	const network_session_config& config
+	)
 {
 	destroy();
 
-	if (!_socket.create(port_number, drop_packets))
+	if (!config.is_valid())
+	{
+		return false;
+	}
+
+	if (!_socket.create(port_number, config.drop_packets, config.max_transmission_unit))
 	{
 		return false;
 	}
@@ -28,6 +48,11 @@ bool network_session::create(
 		return false;
 	}
 
+	if (!_waiter.create(_socket))
+	{
+		return false;
+	}
+
 	std::random_device device;
 	std::mt19937 mt(device());
 
@@ -36,82 +61,304 @@ bool network_session::create(
 	_password = password;
 	_handler = handler;
 
-	_stream_packet_queue_buffer_size = stream_packet_queue_buffer_size;
-	_reliable_packet_queue_buffer_size = reliable_packet_queue_buffer_size;
+	_config = config;
 
-	_receive_packet.buffer = new char[network_session::maximum_transmission_unit];
-	_receive_packet.buffer_length = network_session::maximum_transmission_unit;
+	_receive_pool.create(config.max_transmission_unit, udp_socket::batch_size);
+	_packet_queue_pool.create(config.packet_queue_chunk_size, packet_queue_pool_growth);
+
+	for (uint32_t i = 0; i < udp_socket::batch_size; ++i)
+	{
+		_receive_blocks[i] = _receive_pool.acquire();
+	}
+
+	_probe_buffer = new char[config.max_transmission_unit]();
+	_send_buffer = new char[config.max_transmission_unit];
 
 	return true;
 }
 void network_session::destroy()
 {
-	_socket.destroy();
-
-	if (_receive_packet.buffer != nullptr)
+	if (_probe_buffer != nullptr)
 	{
-		delete[] _receive_packet.buffer;
-		_receive_packet.buffer = 0;
-		_receive_packet.buffer_length = 0;
+		delete[] _probe_buffer;
+		_probe_buffer = nullptr;
 	}
 
-	auto iter = _connections.begin();
-	auto end = _connections.end();
+	if (_send_buffer != nullptr)
+	{
+		delete[] _send_buffer;
+		_send_buffer = nullptr;
+	}
 
-	while (iter != end)
+	for (size_t i = 0; i < _connections.size(); ++i)
 	{
 		char disconnect_message[1];
 		bit_stream stream(disconnect_message, sizeof(disconnect_message));
 		stream.fast_write<uint8_t>(message_type::disconnecting);
-		_socket.send(disconnect_message, stream.size(), iter->remote_address());
-
-		++iter;
+		_socket.send(disconnect_message, stream.size(), _connections.dense_at(i).remote_address());
 	}
 
 	_connections.clear();
+	_connections_by_address.clear();
+	_connections_by_uuid.clear();
+
+	// the connections hand back what they retained before the pool goes
+
+	for (auto iter = _retained_copies.begin(); iter != _retained_copies.end(); ++iter)
+	{
+		delete[] iter->first;
+	}
+
+	_received_batch.clear();
+	_retained_copies.clear();
+	_receive_pool.destroy();
+	_packet_queue_pool.destroy();
+
+	_waiter.destroy();
+	_socket.destroy();
 }
 
-void network_session::send_unreliable(const char* buffer, const uint32_t length, uuid id)
+send_result network_session::send_unreliable(const char* buffer, const uint32_t length, uuid id)
 {
-	if (length > network_session::maximum_transmission_unit)
-		return;
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
 
+	return con->send_unreliable(buffer, length);
+}
+send_result network_session::send_unreliable(const char* buffer, const uint32_t length, connection_handle handle)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_unreliable(buffer, length);
+}
+send_result network_session::send_reliable(const char* buffer, const uint32_t length, uuid id, message_priority priority, uint64_t lifetime)
+{
 	connection* con = find_connection(id);
 
-	if (con != nullptr)
-	{
-		con->send_unreliable(buffer, length);
-	}
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_reliable(buffer, length, priority, lifetime);
 }
-void network_session::send_reliable(const char* buffer, const uint32_t length, uuid id)
+send_result network_session::send_reliable(const char* buffer, const uint32_t length, connection_handle handle, message_priority priority, uint64_t lifetime)
 {
-	if (length + 3 > network_session::maximum_transmission_unit)
-		return;
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
 
+	return con->send_reliable(buffer, length, priority, lifetime);
+}
+send_result network_session::send_stream(const char* buffer, const uint32_t length, uuid id, uint32_t channel, message_priority priority, uint64_t lifetime)
+{
 	connection* con = find_connection(id);
 
-	if (con != nullptr)
-	{
-		con->send_reliable(buffer, length);
-	}
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_stream(buffer, length, channel, priority, lifetime);
 }
-void network_session::send_stream(const char* buffer, const uint32_t length, uuid id)
+send_result network_session::send_stream(const char* buffer, const uint32_t length, connection_handle handle, uint32_t channel, message_priority priority, uint64_t lifetime)
 {
-	if (length + 3 > network_session::maximum_transmission_unit)
-		return;
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
 
+	return con->send_stream(buffer, length, channel, priority, lifetime);
+}
+send_result network_session::send_sequenced(const char* buffer, const uint32_t length, uuid id, uint32_t channel)
+{
 	connection* con = find_connection(id);
 
-	if (con != nullptr)
-	{
-		con->send_stream(buffer, length);
-	}
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_sequenced(buffer, length, channel);
+}
+send_result network_session::send_sequenced(const char* buffer, const uint32_t length, connection_handle handle, uint32_t channel)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_sequenced(buffer, length, channel);
+}
+send_result network_session::send_reliable_latest(const char* buffer, const uint32_t length, uuid id, uint32_t key, message_priority priority)
+{
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_reliable_latest(buffer, length, key, priority);
+}
+send_result network_session::send_reliable_latest(const char* buffer, const uint32_t length, connection_handle handle, uint32_t key, message_priority priority)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->send_reliable_latest(buffer, length, key, priority);
+}
+send_result network_session::reserve_reliable(bit_stream* stream, const uint32_t length, uuid id, message_priority priority, uint64_t lifetime)
+{
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->reserve_reliable(stream, length, priority, lifetime);
+}
+send_result network_session::reserve_reliable(bit_stream* stream, const uint32_t length, connection_handle handle, message_priority priority, uint64_t lifetime)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->reserve_reliable(stream, length, priority, lifetime);
+}
+send_result network_session::commit_reliable(bit_stream& stream, uuid id)
+{
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->commit_reliable(stream);
+}
+send_result network_session::commit_reliable(bit_stream& stream, connection_handle handle)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->commit_reliable(stream);
+}
+send_result network_session::reserve_stream(bit_stream* stream, const uint32_t length, uuid id, uint32_t channel, message_priority priority, uint64_t lifetime)
+{
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->reserve_stream(stream, length, channel, priority, lifetime);
+}
+send_result network_session::reserve_stream(bit_stream* stream, const uint32_t length, connection_handle handle, uint32_t channel, message_priority priority, uint64_t lifetime)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->reserve_stream(stream, length, channel, priority, lifetime);
+}
+send_result network_session::commit_stream(bit_stream& stream, uuid id, uint32_t channel)
+{
+	connection* con = find_connection(id);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->commit_stream(stream, channel);
+}
+send_result network_session::commit_stream(bit_stream& stream, connection_handle handle, uint32_t channel)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+		return send_result_not_connected;
+
+	return con->commit_stream(stream, channel);
+}
+
+bit_stream network_session::retain_message(bit_stream& message)
+{
+	if (message.size() == 0)
+		return bit_stream();
+
+	return bit_stream(retain_buffer(message.begin(), message.size()), message.size());
+}
+void network_session::release_message(bit_stream& message)
+{
+	if (message.size() == 0)
+		return;
+
+	release_buffer(message.begin());
 }
 
 void network_session::update()
 {
 	receive_packets();
+	deliver_batch();
+
 	update_connections();
+
+	_socket.flush();
+}
+
+void network_session::flush()
+{
+	uint64_t current_time = _timer.get_microseconds();
+
+	for (size_t i = 0; i < _connections.size(); ++i)
+	{
+		_connections.dense_at(i).flush(current_time);
+	}
+
+	_socket.flush();
+}
+
+uint64_t network_session::next_deadline()
+{
+	uint64_t current_time = _timer.get_microseconds();
+	uint64_t deadline = network_waiter::no_deadline;
+
+	for (size_t i = 0; i < _connections.size(); ++i)
+	{
+		deadline = std::min(deadline, _connections.dense_at(i).next_deadline(current_time));
+	}
+
+	return deadline;
+}
+
+bool network_session::wait(uint64_t max_wait)
+{
+	return wait_until(wait_deadline(max_wait));
+}
+uint64_t network_session::wait_deadline(uint64_t max_wait)
+{
+	// anything still sitting in the send batch should be on the wire before we sleep
+
+	_socket.flush();
+
+	uint64_t current_time = _timer.get_microseconds();
+	uint64_t deadline = next_deadline();
+
+	if (max_wait != network_waiter::no_deadline && current_time + max_wait < deadline)
+	{
+		deadline = current_time + max_wait;
+	}
+
+	return deadline;
+}
+bool network_session::wait_until(uint64_t deadline)
+{
+	return _waiter.wait(deadline, _timer.get_microseconds());
+}
+void network_session::wait_and_update(uint64_t max_wait)
+{
+	wait(max_wait);
+	update();
 }
 
 void network_session::query(const ip_address& addr)
@@ -127,7 +374,7 @@ void network_session::query(const ip_address& addr)
 
 void network_session::try_connect(const ip_address& addr, uint32_t password)
 {
-	char connect_request_message[25];
+	char connect_request_message[29];
 
 	bit_stream stream(connect_request_message, sizeof(connect_request_message));
 
@@ -135,6 +382,9 @@ void network_session::try_connect(const ip_address& addr, uint32_t password)
 	stream.fast_write<uint32_t>(network_session::protocol_version);
 	stream.fast_write<uint32_t>(password);
 	stream.fast_write<uuid>(_uuid);
+	stream.fast_write<uint8_t>(_config.sequence_bits);
+	stream.fast_write<uint16_t>(_config.window_size);
+	stream.fast_write<uint8_t>(_config.stream_channels);
 
 	_socket.send(connect_request_message, stream.size(), addr);
 }
@@ -149,112 +399,187 @@ void network_session::disconnect(uuid id)
 		stream.fast_write<uint8_t>(message_type::disconnecting);
 		_socket.send(disconnect_message, stream.size(), con->remote_address());
 
-		_connections.erase(_connections.begin() + (con - _connections.data()));
+		remove_connection(con);
 	}
 }
+void network_session::disconnect(connection_handle handle)
+{
+	connection* con = find_connection(handle);
 
-network_session::connection* network_session::find_connection(const ip_address& addr)
+	if (con != nullptr)
+	{
+		char disconnect_message[1];
+		bit_stream stream(disconnect_message, sizeof(disconnect_message));
+		stream.fast_write<uint8_t>(message_type::disconnecting);
+		_socket.send(disconnect_message, stream.size(), con->remote_address());
+
+		remove_connection(con);
+	}
+}
+
+bool network_session::get_connection_stats(uuid id, connection_stats* stats)
 {
-	auto iter = _connections.begin();
-	auto end = _connections.end();
+	connection* con = find_connection(id);
 
-	while (iter != end)
+	if (con == nullptr)
 	{
-		if (iter->remote_address() == addr)
-			return &*iter;
+		return false;
+	}
 
-		++iter;
+	con->get_stats(stats);
+	return true;
+}
+bool network_session::get_connection_stats(connection_handle handle, connection_stats* stats)
+{
+	connection* con = find_connection(handle);
+
+	if (con == nullptr)
+	{
+		return false;
 	}
 
+	con->get_stats(stats);
+	return true;
+}
+
+network_session::connection* network_session::find_connection(const ip_address& addr)
+{
+	auto iter = _connections_by_address.find(addr);
+
+	if (iter != _connections_by_address.end())
+		return _connections.at(iter->second);
+
 	return nullptr;
 }
 network_session::connection* network_session::find_connection(const uuid& id)
 {
-	auto iter = _connections.begin();
-	auto end = _connections.end();
+	auto iter = _connections_by_uuid.find(id);
 
-	while (iter != end)
-	{
-		if (iter->remote_uuid() == id)
-			return &*iter;
+	if (iter != _connections_by_uuid.end())
+		return _connections.at(iter->second);
+
+	return nullptr;
+}
 
-		++iter;
+network_session::connection* network_session::add_connection(const ip_address& addr, const uuid& id, const network_session_config& negotiated)
+{
+	slot_handle slot;
+	connection* con = _connections.emplace(&slot);
+
+	con->create(this, slot, addr, id, negotiated.sequence_bits, negotiated.window_size, negotiated.stream_channels);
+
+	_connections_by_address[addr] = slot.index;
+	_connections_by_uuid[id] = slot.index;
+
+	return con;
+}
+void network_session::remove_connection(connection* con)
+{
+	uint32_t index = con->slot().index;
+
+	_connections_by_address.erase(con->remote_address());
+
+	// a peer that reconnected from a new address may already own the uuid entry
+
+	auto uuid_iter = _connections_by_uuid.find(con->remote_uuid());
+	if (uuid_iter != _connections_by_uuid.end() && uuid_iter->second == index)
+	{
+		_connections_by_uuid.erase(uuid_iter);
 	}
 
-	return nullptr;
+	_connections.erase(index);
 }
 
 void network_session::update_connections()
 {
-	auto con = _connections.begin();
-	auto end = _connections.end();
+	// a handler may disconnect peers while we are updating, removing one swaps the last connection into
+	// its place. walking backwards means whatever is swapped down has already been updated, and the
+	// position is pulled back whenever removals shrink the array below it
+
+	size_t i = _connections.size();
 
-	while (con != end)
+	while (i > 0)
 	{
+		--i;
+
 		uint64_t current_time = _timer.get_microseconds();
 
-		con->update(current_time);
+		_connections.dense_at(i).update(current_time);
+		_connections.dense_at(i).notify_send_ready();
 
-		++con;
+		if (i > _connections.size())
+		{
+			i = _connections.size();
+		}
 	}
 
 	// prune out the recently disconnected connections
+	// walk backwards so the connection swapped into a removed position has already been checked
 
-	bool checked_every_connection = false;
-	while (!checked_every_connection)
+	for (size_t i = _connections.size(); i > 0; --i)
 	{
-		bool found_disconnected = false;
-
-		auto conn = _connections.begin();
-		auto endd = _connections.end();
+		connection* conn = &_connections.dense_at(i - 1);
 
-		while (conn != endd)
+		if (conn->is_disconnected())
 		{
-			if (conn->is_disconnected())
-			{
-				_handler->on_peer_disconnected(conn->remote_uuid());
-				_connections.erase(conn);
-				found_disconnected = true;
-				break;
-			}
-			++conn;
+			_handler->on_peer_disconnected(conn->remote_uuid());
+			remove_connection(conn);
 		}
-
-		if (!found_disconnected)
-			checked_every_connection = true;
 	}
 }
 
 void network_session::receive_packets()
 {
-	ip_address incoming_address;
+	uint32_t received;
 
 	while (
-		_socket.try_receive(
-		_receive_packet.buffer,
-		network_session::maximum_transmission_unit,
-		&_receive_packet.buffer_length,
-		&incoming_address)
+		(received = _socket.try_receive_batch(
+		_receive_blocks,
+		_config.max_transmission_unit,
+		_receive_lengths,
+		_receive_addresses,
+		udp_socket::batch_size)) > 0
 		)
 	{
-		connection* con = find_connection(incoming_address);
-
-		if (con != nullptr)
+		for (uint32_t i = 0; i < received; ++i)
 		{
-			con->receive_message(&_receive_packet, _timer.get_microseconds());
+			packet received_packet;
+			received_packet.buffer = _receive_blocks[i];
+			received_packet.buffer_length = _receive_lengths[i];
 
-			if (con->is_disconnected())
+			connection* con = find_connection(_receive_addresses[i]);
+
+			if (con != nullptr)
 			{
-				_handler->on_peer_disconnected(con->remote_uuid());
+				_receive_time = _timer.get_microseconds();
+
+				con->receive_message(&received_packet, _receive_time);
 
-				_connections.erase(
-					_connections.begin() + (con - _connections.data())
-					);
+				if (con->is_disconnected())
+				{
+					_handler->on_peer_disconnected(con->remote_uuid());
+
+					remove_connection(con);
+				}
+				else
+				{
+					con->notify_send_ready();
+				}
 			}
+			else
+			{
+				handle_unconnected_packet(&received_packet, _receive_addresses[i]);
+			}
+
+			// the block stays with whoever retained it, the next datagram goes into one that is free
+
+			_receive_pool.release(_receive_blocks[i]);
+			_receive_blocks[i] = _receive_pool.acquire();
 		}
-		else
+
+		if (received < udp_socket::batch_size)
 		{
-			handle_unconnected_packet(&_receive_packet, incoming_address);
+			break;
 		}
 	}
 }
@@ -272,12 +597,19 @@ void network_session::handle_unconnected_packet(packet* msg, const ip_address& r
 	{
 	case message_type::connection_request:
 	{
-		if (stream.size() == 25)
+		if (stream.size() == 29)
 		{
 			uint32_t protocol_version = stream.fast_read<uint32_t>();
 			uint32_t password = stream.fast_read<uint32_t>();
 			uuid remote_uuid = stream.fast_read<uuid>();
 
+			// settle on the wider sequence space, the smaller window and the fewer stream channels of the two sides
+
+			network_session_config negotiated = _config;
+			negotiated.sequence_bits = std::max<uint32_t>(_config.sequence_bits, stream.fast_read<uint8_t>());
+			negotiated.window_size = std::min<uint32_t>(_config.window_size, stream.fast_read<uint16_t>());
+			negotiated.stream_channels = std::min<uint32_t>(_config.stream_channels, stream.fast_read<uint8_t>());
+
 			uint32_t result = connection_result_succeeded;
 			if (protocol_version != network_session::protocol_version)
 			{
@@ -291,19 +623,25 @@ void network_session::handle_unconnected_packet(packet* msg, const ip_address& r
 			{
 				result = connection_result_server_full;
 			}
+			else if (!negotiated.is_valid())
+			{
+				result = connection_result_invalid_configuration;
+			}
 
 			if (result == connection_result_succeeded)
 			{
-				char connection_accepted_response[17];
+				char connection_accepted_response[21];
 
-				stream.attach(connection_accepted_response, 17);
+				stream.attach(connection_accepted_response, 21);
 				stream.fast_write<uint8_t>(message_type::connection_accepted);
 				stream.fast_write<uuid>(_uuid);
-				_socket.send(connection_accepted_response, 17, remote_addr);
+				stream.fast_write<uint8_t>(negotiated.sequence_bits);
+				stream.fast_write<uint16_t>(negotiated.window_size);
+				stream.fast_write<uint8_t>(negotiated.stream_channels);
+				_socket.send(connection_accepted_response, 21, remote_addr);
 
-				_connections.push_back(connection());
-				_connections.back().create(this, remote_addr, remote_uuid, _stream_packet_queue_buffer_size, _reliable_packet_queue_buffer_size);
-				_handler->on_peer_joined(remote_uuid);
+				connection* con = add_connection(remote_addr, remote_uuid, negotiated);
+				_handler->on_peer_joined(remote_uuid, connection_handle(con->slot()));
 			}
 			else
 			{
@@ -320,13 +658,23 @@ void network_session::handle_unconnected_packet(packet* msg, const ip_address& r
 	break;
 	case message_type::connection_accepted:
 	{
-		if (stream.size() == 17)
+		if (stream.size() == 21)
 		{
 			uuid remote_uuid = stream.fast_read<uuid>();
 
-			_connections.push_back(connection());
-			_connections.back().create(this, remote_addr, remote_uuid, _stream_packet_queue_buffer_size, _reliable_packet_queue_buffer_size);
-			_handler->on_peer_joined(remote_uuid);
+			network_session_config negotiated = _config;
+			negotiated.sequence_bits = stream.fast_read<uint8_t>();
+			negotiated.window_size = stream.fast_read<uint16_t>();
+			negotiated.stream_channels = stream.fast_read<uint8_t>();
+
+			if (!negotiated.is_valid())
+			{
+				_handler->connect_result_handler(remote_uuid, false, connection_result_invalid_configuration);
+				break;
+			}
+
+			connection* con = add_connection(remote_addr, remote_uuid, negotiated);
+			_handler->on_peer_joined(remote_uuid, connection_handle(con->slot()));
 
 			_handler->connect_result_handler(remote_uuid, true, 0);
 		}
@@ -377,4 +725,88 @@ void network_session::handle_unconnected_packet(packet* msg, const ip_address& r
 	}
 	break;
 	}
+}
+
+char* network_session::retain_buffer(char* buffer, size_t length)
+{
+	if (_receive_pool.owns(buffer))
+	{
+		_receive_pool.retain(buffer);
+		return buffer;
+	}
+
+	auto iter = _retained_copies.find(buffer);
+
+	if (iter != _retained_copies.end())
+	{
+		++iter->second;
+		return buffer;
+	}
+
+	// anything small enough still gets a block, only large reassembled messages go to the heap
+
+	char* copy;
+
+	if (length <= _receive_pool.block_size())
+	{
+		copy = _receive_pool.acquire();
+	}
+	else
+	{
+		copy = new char[length];
+		_retained_copies[copy] = 1;
+	}
+
+	memcpy(copy, buffer, length);
+	return copy;
+}
+void network_session::release_buffer(char* buffer)
+{
+	if (_receive_pool.owns(buffer))
+	{
+		_receive_pool.release(buffer);
+		return;
+	}
+
+	auto iter = _retained_copies.find(buffer);
+
+	if (iter != _retained_copies.end() && --iter->second == 0)
+	{
+		delete[] iter->first;
+		_retained_copies.erase(iter);
+	}
+}
+
+void network_session::deliver_message(connection* con, char* buffer, size_t length)
+{
+	if (!_config.batch_delivery)
+	{
+		_handler->on_message_received(bit_stream(buffer, length), con->remote_uuid());
+		return;
+	}
+
+	// the receive buffer is reused after its datagram is processed, so every message in the batch holds on to it
+
+	received_message received;
+	received.message = length == 0 ? bit_stream() : bit_stream(retain_buffer(buffer, length), length);
+	received.id = con->remote_uuid();
+	received.handle = connection_handle(con->slot());
+	received.receive_time = _receive_time;
+
+	_received_batch.push_back(received);
+}
+void network_session::deliver_batch()
+{
+	if (_received_batch.empty())
+		return;
+
+	_handler->on_messages_received(_received_batch.data(), _received_batch.size());
+
+	for (size_t i = 0; i < _received_batch.size(); ++i)
+	{
+		release_message(_received_batch[i].message);
+	}
+
+	// keeps its capacity for the next update
+	_received_batch.clear();
 }
\ No newline at end of file
@@ -1,241 +1,240 @@
 #include "include/network_session.h"
 
-network_session::connection::reliable_messenger::reliable_messenger() :
-	_session(nullptr),
-	_connection(nullptr),
-	_local_low_n_sent(0),
-	_local_low_n_received(0),
-	_local_messages_received(0),
-	_remote_low_n_received(0),
-	_remote_messages_received(0),
-	_last_ack_time(0),
-	_last_resend_time(0) { }
-
-void network_session::connection::reliable_messenger::create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size)
+void network_session::connection::reliable_messenger::create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size)
 {
-	_session = session;
-	_connection = connection;
+	messenger::create(session, connection, packet_queue_buffer_size, sequence_bits, window_size, message_type::reliable, message_type::reliable_ack, 1, 0);
 
-	_local_low_n_sent = 0;
-	_local_low_n_received = 0;
-	_local_messages_received = 0;
-
-	_remote_low_n_received = 0;
-	_remote_messages_received = 0;
+	_latest_sent.clear();
+	_latest_received.clear();
+}
 
-	uint64_t current_time = session->_timer.get_microseconds();
-	_last_ack_time = current_time;
-	_last_resend_time = current_time;
+void network_session::connection::reliable_messenger::receive_message(bit_stream& stream, uint64_t current_time)
+{
+	if (stream.size() >= header_size())
+	{
+		uint32_t message_id = _sequence.read(stream);
 
-	_allocator.create(packet_queue_buffer_size);
+		receive_ack(_sequence.read(stream), current_time, true);
 
-	for (uint32_t i = 0; i < window_size; ++i)
-	{
-		_window[i].buffer = nullptr;
-		_window[i].buffer_length = 0;
-	}
+		bit_stream message(stream.seek(), stream.size() - stream.tell());
 
-	while (!_queue.empty())
-	{
-		_queue.pop();
-	}
-}
+		uint32_t message_index = _sequence.distance(message_id, _local_low_n_received);
+		uint32_t message_slot = message_id & (_window_size - 1);
 
-void network_session::connection::reliable_messenger::receive_ack(uint8_t new_rnd, uint16_t new_status, uint64_t current_time)
-{
-	// ensure the new_rnd has either remained the same or acknowledged some packets
+		bool is_new = message_index < _window_size && !_received[message_slot];
+		bool had_gap = _local_high_n_distance > 0;
 
-	uint32_t dist_old_rnd = modulus_distance(_local_low_n_sent, _remote_low_n_received);
-	uint32_t dist_new_rnd = modulus_distance(_local_low_n_sent, new_rnd);
+		// a fragment that can't be taken in is dropped unacknowledged, as if it was lost
 
-	if (dist_new_rnd <= dist_old_rnd)
-	{
-		_last_ack_time = current_time;
+		if (is_new && !can_accept(message_id, stream.begin(), stream.size()))
+		{
+			return;
+		}
 
-		if (new_rnd < _remote_low_n_received)
+		if (is_new)
 		{
-			for (uint32_t i = _remote_low_n_received; i <= reliable_messenger::maximum_sequence_number; ++i)
-			{
-				uint32_t message_index = i % reliable_messenger::window_size;
+			_received[message_slot] = 1;
+			_local_high_n_distance = std::max(_local_high_n_distance, message_index);
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
-			}
-			for (uint32_t i = 0; i < new_rnd; ++i)
-			{
-				uint32_t message_index = i % reliable_messenger::window_size;
+			// slide the window past every message we now have in order
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
-			}
-		}
-		else
-		{
-			for (uint32_t i = _remote_low_n_received; i < new_rnd; ++i)
+			// the latest keys are swept every half window, so an id is gone well before the sequence wraps
+
+			uint32_t sweep_mask = _window_size > 1 ? _window_size / 2 - 1 : 0;
+
+			while (_received[_local_low_n_received & (_window_size - 1)])
 			{
-				uint32_t message_index = i % reliable_messenger::window_size;
+				_received[_local_low_n_received & (_window_size - 1)] = 0;
+				_local_low_n_received = _sequence.add(_local_low_n_received, 1);
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
+				if (_local_high_n_distance > 0)
+				{
+					--_local_high_n_distance;
+				}
+
+				if ((_local_low_n_received & sweep_mask) == 0 && !_latest_received.empty())
+				{
+					prune_latest_received();
+				}
 			}
 		}
 
-		_remote_messages_received = new_status;
-		_remote_low_n_received = new_rnd;
+		// duplicates, messages past a gap and messages filling one are acknowledged right away so the
+		// remote learns what is missing as soon as possible, anything else may wait for a piggyback
+
+		schedule_ack(!is_new || message_index > 0 || had_gap, current_time);
+
+		if (is_new)
+		{
+			deliver(message_id, stream.begin(), stream.size());
+		}
 	}
 }
-void network_session::connection::reliable_messenger::receive_message(bit_stream& stream, uint64_t current_time)
+
+bool network_session::connection::reliable_messenger::can_accept(uint32_t message_id, char* packet, size_t packet_length)
 {
-	if (stream.size() >= 5)
-	{
-		uint8_t message_id = stream.fast_read<uint8_t>();
+	if ((*packet & message_type::fragment) == 0)
+		return true;
 
-		uint8_t remote_low_n_received = stream.fast_read<uint8_t>();
-		uint16_t remote_messages_received = stream.fast_read<uint16_t>();
+	message_fragment fragment;
 
-		receive_ack(remote_low_n_received, remote_messages_received, current_time);
+	if (!fragment.read(packet + header_size(), packet_length - header_size()))
+		return false;
 
-		uint32_t message_index = modulus_distance(message_id, _local_low_n_received);
-		uint32_t message_flag = 1 << message_index;
+	// fragments are assembled as they arrive, several messages may be in progress at once
 
-		if (
-			message_index < reliable_messenger::window_size
-			&& !(_local_messages_received & message_flag)
-			)
-		{
-			_local_messages_received |= message_flag;
+	uint32_t first_id = _sequence.distance(message_id, fragment.index);
 
-			while (_local_messages_received & 1)
-			{
-				++_local_low_n_received;
-				_local_messages_received = _local_messages_received >> 1;
-			}
-
-			_session->_handler->on_message_received(
-				bit_stream(stream.seek(), stream.size() - stream.tell()),
-				_connection->_remote_uuid
-				);
+	return _assembler.can_accept(first_id, fragment);
+}
+void network_session::connection::reliable_messenger::prune_latest_received()
+{
+	for (auto iter = _latest_received.begin(); iter != _latest_received.end();)
+	{
+		// an id delivered past a gap is ahead of the low end, it wraps around to a large distance behind it
 
-			char reliable_ack[4];
-			stream.attach(reliable_ack, 4);
-			stream.fast_write<uint8_t>(message_type::reliable_ack);
-			stream.fast_write<uint8_t>(_local_low_n_received);
-			stream.fast_write<uint16_t>(_local_messages_received);
+		bool is_ahead = _sequence.distance(iter->second, _local_low_n_received) < _window_size;
 
-			_session->_socket.send(reliable_ack, 4, _connection->_remote_address);
+		if (!is_ahead && _sequence.distance(_local_low_n_received, iter->second) >= _window_size)
+		{
+			iter = _latest_received.erase(iter);
+		}
+		else
+		{
+			++iter;
 		}
 	}
 }
-
-void network_session::connection::reliable_messenger::send(const char* buffer, const uint32_t length)
+void network_session::connection::reliable_messenger::deliver(uint32_t message_id, char* packet, size_t packet_length)
 {
-	packet p;
-	p.buffer_length = length + 5;
-	p.buffer = _allocator.push_back(p.buffer_length);
-
-	memcpy(p.buffer + 5, buffer, length);
+	uint8_t flags = *packet;
 
-	_queue.push(p);
-}
+	char* buffer = packet + header_size();
+	size_t length = packet_length - header_size();
 
-void network_session::connection::reliable_messenger::update(uint64_t current_time)
-{
-	bit_stream reliable;
-	while (!_queue.empty() && modulus_distance(_local_low_n_sent, _remote_low_n_received) < reliable_messenger::window_size)
+	if (flags & message_type::latest)
 	{
-		// reset the resend time on the connection because we are sending a message
+		if (length < 4)
+			return;
+
+		bit_stream latest(buffer, length);
+		uint32_t key = latest.fast_read<uint32_t>();
 
-		_last_resend_time = current_time;
+		// an older message for the key can still turn up after a newer one was delivered, both were in
+		// the window together so the newer one is the one less than a window ahead
 
-		// move the queued message to the window
+		auto newest = _latest_received.find(key);
 
-		uint32_t message_index = _local_low_n_sent % reliable_messenger::window_size;
+		if (newest != _latest_received.end() && _sequence.distance(newest->second, message_id) < _window_size)
+			return;
 
-		_window[message_index] = _queue.front();
-		_queue.pop();
+		_latest_received[key] = message_id;
 
-		// write the packet header and send it
+		_session->deliver_message(_connection, latest.seek(), length - 4);
+		return;
+	}
 
-		reliable.attach(
-			_window[message_index].buffer,
-			_window[message_index].buffer_length
-			);
+	messenger::deliver(message_id, packet, packet_length);
+}
 
-		reliable.fast_write<uint8_t>(message_type::reliable);
-		reliable.fast_write<uint8_t>(_local_low_n_sent);
-		reliable.fast_write<uint8_t>(_local_low_n_received);
-		reliable.fast_write<uint16_t>(_local_messages_received);
+send_result network_session::connection::reliable_messenger::send_latest(const char* buffer, const uint32_t length, uint32_t key, uint32_t priority)
+{
+	if (header_size() + 4 + length > max_packet_size())
+		return send_result_invalid;
 
-		_session->_socket.send(
-			_window[message_index].buffer,
-			_window[message_index].buffer_length,
-			_connection->_remote_address
-			);
+	// latest messages are never coalesced, like in send the open packet is closed before allocating
 
-		// advance the window forward, let it wrap around
+	flush();
 
-		++_local_low_n_sent;
-	}
+	packet p;
+	p.buffer_length = header_size() + 4 + length;
+	p.buffer = _allocator.push_back(p.buffer_length);
 
-	uint64_t time_since_last_resend = current_time - _last_resend_time;
+	if (p.buffer == nullptr)
+		return allocation_failed(p.buffer_length);
 
-	// resend messages if we have unacknowledged messages and haven't sent a reliable message in a while
+	p.allocation = p.buffer;
+	p.messages = 1;
 
-	if (
-		time_since_last_resend > network_session::resend_time &&
-		modulus_distance(_local_low_n_sent, _remote_low_n_received) > 0
-		)
+	// the previous message for the key is superseded whether it is still queued or waiting in the
+	// window to be acknowledged, a queued one is dropped before it ever takes a message id
+
+	auto previous = _latest_sent.find(key);
+
+	if (previous != _latest_sent.end())
 	{
-		_last_resend_time = current_time;
-		uint32_t message_flag = 1;
+		const latest_message& latest = previous->second;
 
-		if (_local_low_n_sent < _remote_low_n_received)
+		if (latest.queued)
 		{
-			for (uint32_t i = _remote_low_n_received; i <= reliable_messenger::maximum_sequence_number; ++i)
-			{
-				if (!(_remote_messages_received & message_flag))
-				{
-					resend_message(i);
-				}
-				message_flag = message_flag << 1;
-			}
-			for (uint32_t i = 0; i < _local_low_n_sent; ++i)
-			{
-				if (!(_remote_messages_received & message_flag))
-				{
-					resend_message(i);
-				}
-				message_flag = message_flag << 1;
-			}
+			packet* queued = &_queues[latest.priority].at_index(latest.queue_index);
+
+			supersede(*queued, key);
+
+			_queued_messages -= queued->messages;
+			queued->messages = 0;
+			queued->superseded = true;
 		}
-		else
+		else if (_sequence.distance(latest.message_id, _remote_low_n_received) < in_flight())
 		{
-			for (uint32_t i = _remote_low_n_received; i < _local_low_n_sent; ++i)
-			{
-				if (!(_remote_messages_received & message_flag))
-				{
-					resend_message(i);
-				}
-				message_flag = message_flag << 1;
-			}
+			supersede(_window[latest.message_id & (_window_size - 1)], key);
 		}
 	}
+
+	*p.buffer = message_type::reliable | message_type::latest;
+
+	bit_stream latest(p.buffer + header_size(), 4 + length);
+	latest.fast_write<uint32_t>(key);
+	memcpy(latest.seek(), buffer, length);
+
+	_queues[priority].push_back(p);
+	_latest_sent[key] = { true, priority, _queues[priority].back_index(), 0 };
+	++_queued_messages;
+	return send_result_accepted;
 }
+void network_session::connection::reliable_messenger::supersede(packet& p, uint32_t key)
+{
+	if (p.acknowledged || (*p.buffer & message_type::latest) == 0)
+		return;
+
+	bit_stream latest(p.buffer + header_size(), 4);
+
+	if (latest.fast_read<uint32_t>() != key)
+		return;
+
+	// the message id still has to be delivered for the window to move on, an empty coalesced packet
+	// is the smallest message that delivers nothing
 
-void network_session::connection::reliable_messenger::resend_message(uint32_t seq)
+	*p.buffer = message_type::reliable | message_type::coalesced;
+	p.buffer_length = header_size();
+}
+bool network_session::connection::reliable_messenger::latest_key(const packet& p, uint32_t* key) const
 {
-	uint32_t message_index = seq % reliable_messenger::window_size;
+	if ((*p.buffer & message_type::latest) == 0)
+		return false;
+
+	bit_stream latest(p.buffer + header_size(), 4);
+	*key = latest.fast_read<uint32_t>();
+	return true;
+}
 
-	// we need to update the next desired field of the header, it may have changed
+void network_session::connection::reliable_messenger::on_sent(uint32_t message_id, const packet& p, uint64_t)
+{
+	// from here on a reliable latest message is found by its message id
 
-	bit_stream reliable = _window[message_index].get_stream();
-	reliable.skip(2);
-	reliable.fast_write<uint8_t>(_local_low_n_received);
-	reliable.fast_write<uint16_t>(_local_messages_received);
+	uint32_t key;
 
-	_session->_socket.send(
-		_window[message_index].buffer,
-		_window[message_index].buffer_length,
-		_connection->_remote_address
-		);
+	if (latest_key(p, &key))
+	{
+		_latest_sent[key] = { false, 0, 0, message_id };
+	}
+}
+void network_session::connection::reliable_messenger::on_dropped(const packet& p)
+{
+	uint32_t key;
+
+	if (latest_key(p, &key))
+	{
+		_latest_sent.erase(key);
+	}
 }
\ No newline at end of file
@@ -1,204 +1,352 @@
 #include "include/network_session.h"
 
 network_session::connection::stream_messenger::stream_messenger() :
-	_session(nullptr),
-	_connection(nullptr),
-	_local_low_n_sent(0),
-	_local_low_n_received(0),
-	_remote_low_n_received(0),
-	_last_ack_time(0),
-	_last_resend_time(0) { }
-
-void network_session::connection::stream_messenger::create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size)
+	_fec_group_size(0),
+	_fec_first(0),
+	_fec_count(0),
+	_fec_deadline(0),
+	_fec_length(0),
+	_fec_size(0),
+	_fec_active(false),
+	_parity_packets_sent(0),
+	_messages_protected(0),
+	_messages_recovered(0) { }
+network_session::connection::stream_messenger::~stream_messenger()
 {
-	_session = session;
-	_connection = connection;
+	for (size_t i = 0; i < _buffered.size(); ++i)
+	{
+		if (_buffered[i].buffer != nullptr)
+		{
+			_session->release_buffer(_buffered[i].buffer);
+		}
+	}
+}
 
-	_local_low_n_sent = 0;
-	_local_low_n_received = 0;
+void network_session::connection::stream_messenger::create(network_session* session, network_session::connection* connection, size_t packet_queue_buffer_size, uint32_t sequence_bits, uint32_t window_size, uint8_t channel)
+{
+	messenger::create(session, connection, packet_queue_buffer_size, sequence_bits, window_size, message_type::stream, message_type::stream_ack, 2, channel);
 
-	_remote_low_n_received = 0;
+	_buffered.assign(_window_size, packet());
 
-	uint64_t current_time = session->_timer.get_microseconds();
-	_last_ack_time = current_time;
-	_last_resend_time = current_time;
+	_fec_group_size = (session->_config.fec_channels >> channel) & 1 ? std::min(session->_config.fec_group_size, window_size / 2) : 0;
+	_fec_first = 0;
+	_fec_count = 0;
+	_fec_deadline = 0;
+	_fec_length = 0;
+	_fec_size = 0;
+	_fec_parity.assign(_fec_group_size != 0 ? parity_header_size() + session->_config.max_transmission_unit : 0, 0);
 
-	_allocator.create(packet_queue_buffer_size);
+	// with forward error correction a packet is kept small enough for the parity of its group to fit the mtu
+	_packet_reserve = _fec_group_size != 0 ? parity_header_size() + 1 - header_size() : 0;
 
-	for (uint32_t i = 0; i < window_size; ++i)
-	{
-		_window[i].buffer = nullptr;
-		_window[i].buffer_length = 0;
-	}
+	_fec_active = false;
+	_fec_history.clear();
+	_fec_history_id.clear();
 
-	while (!_queue.empty())
+	_parity_packets_sent = 0;
+	_messages_protected = 0;
+	_messages_recovered = 0;
+}
+
+void network_session::connection::stream_messenger::receive_message(bit_stream& stream, uint64_t current_time)
+{
+	if (stream.size() >= header_size())
 	{
-		_queue.pop();
+		uint32_t message_id = _sequence.read(stream);
+
+		receive_ack(_sequence.read(stream), current_time, true);
+
+		accept_message(message_id, stream.begin(), stream.size(), current_time);
 	}
 }
-
-void network_session::connection::stream_messenger::receive_ack(uint8_t new_rnd, uint64_t current_time)
+void network_session::connection::stream_messenger::accept_message(uint32_t message_id, char* packet, size_t packet_length, uint64_t current_time)
 {
-	// ensure the new_rnd has either remained the same or acknowledged some packets
+	uint32_t message_index = _sequence.distance(message_id, _local_low_n_received);
+	uint32_t message_slot = message_id & (_window_size - 1);
+
+	bool is_new = message_index < _window_size && !_received[message_slot];
+	bool had_gap = _local_high_n_distance > 0;
 
-	uint32_t dist_old_rnd = modulus_distance(_local_low_n_sent, _remote_low_n_received);
-	uint32_t dist_new_rnd = modulus_distance(_local_low_n_sent, new_rnd);
+	// a fragment that can't be taken in is dropped unacknowledged, as if it was lost
 
-	if (dist_new_rnd <= dist_old_rnd)
+	if (is_new && !can_accept(packet, packet_length))
 	{
-		_last_ack_time = current_time;
+		return;
+	}
+
+	uint32_t first_deliverable = _local_low_n_received;
+	uint32_t deliverable = 0;
+
+	if (is_new)
+	{
+		_received[message_slot] = 1;
+		_local_high_n_distance = std::max(_local_high_n_distance, message_index);
 
-		if (new_rnd < _remote_low_n_received)
+		// the protected bytes are the header byte followed by the data, copied so the header byte lands right before the data
+
+		if (_fec_active)
 		{
-			for (uint32_t i = _remote_low_n_received; i <= stream_messenger::maximum_sequence_number; ++i)
-			{
-				uint32_t message_index = i % stream_messenger::window_size;
+			_fec_history[message_slot].assign(packet + header_size() - 1, packet + packet_length);
+			_fec_history[message_slot][0] = *packet;
+			_fec_history_id[message_slot] = message_id;
+		}
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
-			}
-			for (uint32_t i = 0; i < new_rnd; ++i)
-			{
-				uint32_t message_index = i % stream_messenger::window_size;
+		// messages past a gap are held until the gap is filled, by reference to the buffer they arrived in
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
-			}
+		if (message_index > 0)
+		{
+			_buffered[message_slot].buffer = _session->retain_buffer(packet, packet_length);
+			_buffered[message_slot].buffer_length = packet_length;
 		}
-		else
+
+		// slide the window past every message we now have in order
+
+		while (_received[_local_low_n_received & (_window_size - 1)])
 		{
-			for (uint32_t i = _remote_low_n_received; i < new_rnd; ++i)
-			{
-				uint32_t message_index = i % stream_messenger::window_size;
+			_received[_local_low_n_received & (_window_size - 1)] = 0;
+			_local_low_n_received = _sequence.add(_local_low_n_received, 1);
 
-				_allocator.pop_front();
-				_window[message_index] = packet();
+			if (_local_high_n_distance > 0)
+			{
+				--_local_high_n_distance;
 			}
-		}
 
-		_remote_low_n_received = new_rnd;
+			++deliverable;
+		}
 	}
-}
-void network_session::connection::stream_messenger::receive_message(bit_stream& stream, uint64_t current_time)
-{
-	if (stream.size() >= 3)
-	{
-		uint8_t message_id = stream.fast_read<uint8_t>();
 
-		receive_ack(stream.fast_read<uint8_t>(), current_time);
+	// duplicates, messages past a gap and messages filling one are acknowledged right away so the
+	// remote learns what is missing as soon as possible, anything else may wait for a piggyback
+
+	schedule_ack(!is_new || message_index > 0 || had_gap, current_time);
+
+	// deliver in order, the first message is the one that just arrived and the rest were buffered
 
-		if (message_id == _local_low_n_received)
+	for (uint32_t i = 0; i < deliverable; ++i)
+	{
+		if (i == 0)
 		{
-			++_local_low_n_received;
-			_session->_handler->on_message_received(
-				bit_stream(stream.seek(), stream.size() - stream.tell()),
-				_connection->_remote_uuid
-				);
-
-			char reliable_ack[2];
-			stream.attach(reliable_ack, 2);
-			stream.fast_write<uint8_t>(message_type::stream_ack);
-			stream.fast_write<uint8_t>(_local_low_n_received);
-
-			_session->_socket.send(reliable_ack, 2, _connection->_remote_address);
+			deliver(message_id, packet, packet_length);
+			continue;
 		}
+
+		// buffered messages are kept whole, header included
+
+		uint32_t buffered_id = _sequence.add(first_deliverable, i);
+		auto& buffered = _buffered[buffered_id & (_window_size - 1)];
+
+		deliver(buffered_id, buffered.buffer, buffered.buffer_length);
+
+		_session->release_buffer(buffered.buffer);
+		buffered.buffer = nullptr;
 	}
 }
-
-void network_session::connection::stream_messenger::send(const char* buffer, const uint32_t length)
+void network_session::connection::stream_messenger::receive_parity(bit_stream& stream, uint64_t current_time)
 {
-	packet p;
-	p.buffer_length = length + 3;
-	p.buffer = _allocator.push_back(p.buffer_length);
+	if (stream.size() < parity_header_size())
+	{
+		return;
+	}
 
-	memcpy(p.buffer + 3, buffer, length);
+	uint32_t first_id = _sequence.read(stream);
+	uint32_t count = stream.fast_read<uint8_t>();
+	uint32_t length = stream.fast_read<uint16_t>();
 
-	_queue.push(p);
-}
+	char* parity = stream.seek();
+	size_t parity_length = stream.size() - stream.tell();
 
-void network_session::connection::stream_messenger::update(uint64_t current_time)
-{
-	bit_stream stream;
-	while (!_queue.empty() && modulus_distance(_local_low_n_sent, _remote_low_n_received) < stream_messenger::window_size)
+	// messages are only kept once the remote is known to send parity, the group this parity is for can't be recovered
+	// the history starts out with ids that never map to their slot
+
+	if (!_fec_active)
 	{
-		// reset the resend time on the connection because we are sending a message
+		_fec_active = true;
+		_fec_history.assign(_window_size, std::vector<char>());
+		_fec_history_id.resize(_window_size);
 
-		_last_resend_time = current_time;
+		for (uint32_t i = 0; i < _window_size; ++i)
+		{
+			_fec_history_id[i] = i + 1;
+		}
 
-		// move the queued message to the window
+		return;
+	}
 
-		uint32_t message_index = _local_low_n_sent % stream_messenger::window_size;
+	if (count == 0 || count > _window_size / 2)
+	{
+		return;
+	}
 
-		_window[message_index] = _queue.front();
-		_queue.pop();
+	// xor can rebuild a single missing message, the rest of the group has to be in the history
 
-		// write the packet header and send it
+	uint32_t missing_id = 0;
+	uint32_t missing = 0;
 
-		stream.attach(
-			_window[message_index].buffer,
-			_window[message_index].buffer_length
-			);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t message_id = _sequence.add(first_id, i);
 
-		stream.fast_write<uint8_t>(message_type::stream);
-		stream.fast_write<uint8_t>(_local_low_n_sent);
-		stream.fast_write<uint8_t>(_local_low_n_received);
+		if (_sequence.distance(message_id, _local_low_n_received) < _window_size && !_received[message_id & (_window_size - 1)])
+		{
+			missing_id = message_id;
+			++missing;
+		}
+	}
 
-		_session->_socket.send(
-			_window[message_index].buffer,
-			_window[message_index].buffer_length,
-			_connection->_remote_address
-			);
+	if (missing != 1)
+	{
+		return;
+	}
 
-		// advance the window forward, let it wrap around
+	// the protected bytes are rebuilt right after where the header byte goes, so they end up laid out like a packet
+	// in a receive buffer, which can be retained like any other
 
-		++_local_low_n_sent;
+	if (header_size() - 1 + parity_length > _session->_receive_pool.block_size())
+	{
+		return;
 	}
 
-	uint64_t time_since_last_resend = current_time - _last_resend_time;
+	char* recovery = _session->_receive_pool.acquire();
+	char* recovered = recovery + header_size() - 1;
+
+	memset(recovery, 0, header_size() - 1);
 
-	// resend messages if we have unacknowledged messages and haven't sent a reliable message in a while
+	memcpy(recovered, parity, parity_length);
 
-	if (
-		time_since_last_resend > network_session::resend_time &&
-		modulus_distance(_local_low_n_sent, _remote_low_n_received) > 0
-		)
+	for (uint32_t i = 0; i < count; ++i)
 	{
-		_last_resend_time = current_time;
+		uint32_t message_id = _sequence.add(first_id, i);
+		uint32_t message_slot = message_id & (_window_size - 1);
 
-		if (_local_low_n_sent < _remote_low_n_received)
+		if (message_id == missing_id)
 		{
-			for (uint32_t i = _remote_low_n_received; i <= stream_messenger::maximum_sequence_number; ++i)
-			{
-				resend_message(i);
-			}
-			for (uint32_t i = 0; i < _local_low_n_sent; ++i)
-			{
-				resend_message(i);
-			}
+			continue;
+		}
+
+		const std::vector<char>& history = _fec_history[message_slot];
+
+		if (_fec_history_id[message_slot] != message_id || history.size() > parity_length)
+		{
+			_session->release_buffer(recovery);
+			return;
 		}
-		else
+
+		for (size_t j = 0; j < history.size(); ++j)
 		{
-			for (uint32_t i = _remote_low_n_received; i < _local_low_n_sent; ++i)
-			{
-				resend_message(i);
-			}
+			recovered[j] ^= history[j];
 		}
+
+		length ^= (uint32_t)history.size();
 	}
+
+	if (length == 0 || length > parity_length)
+	{
+		_session->release_buffer(recovery);
+		return;
+	}
+
+	recovery[0] = recovered[0];
+	++_messages_recovered;
+
+	accept_message(missing_id, recovery, header_size() - 1 + length, current_time);
+
+	_session->release_buffer(recovery);
 }
 
-void network_session::connection::stream_messenger::resend_message(uint32_t seq)
+bool network_session::connection::stream_messenger::can_accept(char* packet, size_t packet_length)
 {
-	uint32_t message_index = seq % stream_messenger::window_size;
+	if ((*packet & message_type::fragment) == 0)
+		return true;
 
-	// we need to update the next desired field of the header, it may have changed
+	message_fragment fragment;
+
+	if (!fragment.read(packet + header_size(), packet_length - header_size()))
+		return false;
+
+	// fragments are only assembled as they are delivered in order, so there is never more than one
+	// message in progress and the assembler always has room for it
+
+	return fragment.message_length <= _session->_config.max_message_size;
+}
+
+void network_session::connection::stream_messenger::on_sent(uint32_t message_id, const packet& p, uint64_t current_time)
+{
+	if (_fec_group_size == 0)
+	{
+		return;
+	}
+
+	if (_fec_count == 0)
+	{
+		_fec_first = message_id;
+		_fec_deadline = current_time + network_session::ack_delay_time;
+	}
 
-	bit_stream stream = _window[message_index].get_stream();
-	stream.skip(2);
-	stream.fast_write<uint8_t>(_local_low_n_received);
+	// the header byte followed by the data, the channel and sequence numbers are known to the remote
+
+	char* parity = _fec_parity.data() + parity_header_size();
+	size_t protected_length = p.buffer_length - header_size() + 1;
+
+	parity[0] ^= p.buffer[0];
+
+	for (size_t i = 1; i < protected_length; ++i)
+	{
+		parity[i] ^= p.buffer[header_size() - 1 + i];
+	}
+
+	_fec_length ^= (uint32_t)protected_length;
+	_fec_size = std::max(_fec_size, protected_length);
+
+	++_messages_protected;
+
+	if (++_fec_count == _fec_group_size)
+	{
+		send_parity(current_time);
+	}
+}
+void network_session::connection::stream_messenger::send_parity(uint64_t current_time)
+{
+	bit_stream header(_fec_parity.data(), parity_header_size());
+	header.fast_write<uint8_t>(message_type::stream_parity);
+	header.fast_write<uint8_t>(_channel);
+	_sequence.write(header, _fec_first);
+	header.fast_write<uint8_t>((uint8_t)_fec_count);
+	header.fast_write<uint16_t>((uint16_t)_fec_length);
+
+	// parity isn't acknowledged or resent, it only counts towards the pacing
+
+	_connection->send_packet(_fec_parity.data(), parity_header_size() + _fec_size);
+
+	_connection->on_packet_sent(current_time);
+	++_parity_packets_sent;
+
+	memset(_fec_parity.data() + parity_header_size(), 0, _fec_size);
+
+	_fec_count = 0;
+	_fec_length = 0;
+	_fec_size = 0;
+}
+
+void network_session::connection::stream_messenger::update(uint64_t current_time)
+{
+	messenger::update(current_time);
+
+	// the last messages of a burst may not fill a group, their parity goes out short rather than waiting
+	// on later traffic, which is still sooner than a tail loss probe
+
+	if (_fec_count != 0 && current_time >= _fec_deadline)
+	{
+		send_parity(current_time);
+	}
+}
+uint64_t network_session::connection::stream_messenger::next_deadline(uint64_t current_time) const
+{
+	uint64_t deadline = messenger::next_deadline(current_time);
+
+	if (_fec_count != 0)
+	{
+		deadline = std::min(deadline, _fec_deadline);
+	}
 
-	_session->_socket.send(
-		_window[message_index].buffer,
-		_window[message_index].buffer_length,
-		_connection->_remote_address
-		);
+	return deadline;
 }
\ No newline at end of file
@@ -55,13 +55,21 @@ public:
 
 		std::thread background([&]
 		{
+			// only the blocking half of the wait runs without the lock so the sending thread isn't
+			// starved while nothing arrives
+
 			while (true)
 			{
+				uint64_t deadline;
 				{
 					std::lock_guard<std::mutex> lg(sync);
-					ses.update();
+					deadline = ses.wait_deadline(1000);
 				}
-				std::this_thread::yield();
+
+				ses.wait_until(deadline);
+
+				std::lock_guard<std::mutex> lg(sync);
+				ses.update();
 			}
 		});
 
@@ -92,17 +100,28 @@ public:
 		std::cout << "beginning reliable stress test. sending 100 packets of 100 uint32's with a lossy connection." << std::endl;
 
 		{
-			uint32_t buffer[100];
 			std::lock_guard<std::mutex> lg(sync);
 
+			connection_handle remote_handle = ses.find_handle(remote);
+
+			// the numbers are written straight into the session's packet queue buffer
+
 			for (uint32_t i = 0; i < 100; ++i)
 			{
+				bit_stream stream;
+
+				if (ses.reserve_reliable(&stream, 100 * sizeof(uint32_t), remote_handle) != send_result_accepted)
+				{
+					std::cout << "the packet queue buffer is full" << std::endl;
+					break;
+				}
+
 				for (uint32_t j = i * 100, k = 0; k < 100; ++j, ++k)
 				{
-					buffer[k] = j;
+					stream.fast_write<uint32_t>(j);
 				}
 
-				ses.send_reliable((char*)buffer, sizeof(buffer), remote);
+				ses.commit_reliable(stream, remote_handle);
 			}
 		}
 
@@ -121,11 +140,8 @@ private:
 
 int main(int argc, char** argv)
 {
-	WSAData wsa_data;
-
-	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	if (!network_startup())
 	{
-		printf("error initializing WSA\n");
 		return 1;
 	}
 
@@ -143,7 +159,7 @@ int main(int argc, char** argv)
 
 	printf("terminating..\n");
 
-	WSACleanup();
+	network_shutdown();
 
 	return 0;
 }
\ No newline at end of file
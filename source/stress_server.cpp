@@ -42,8 +42,7 @@ public:
 
 		while (true)
 		{
-			ses.update();
-			std::this_thread::yield();
+			ses.wait_and_update(network_waiter::no_deadline);
 		}
 	}
 
@@ -84,11 +83,8 @@ private:
 
 int main(int argc, char** argv)
 {
-	WSAData wsa_data;
-
-	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	if (!network_startup())
 	{
-		printf("error initializing WSA\n");
 		return 1;
 	}
 
@@ -106,7 +102,7 @@ int main(int argc, char** argv)
 
 	printf("terminating..\n");
 
-	WSACleanup();
+	network_shutdown();
 
 	return 0;
 }
\ No newline at end of file